@@ -1,79 +1,98 @@
-/* avatar-build is distributed under MIT license:
- *
- * Copyright (c) 2021 Kota Iguchi
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
- * SOFTWARE.
- */
-#pragma once
-
-#include "DSPatch.h"
-#include "pipelines.hpp"
-#include <string>
-#include <iostream>
-#include <vector>
-
-namespace AvatarBuild {
-
-class fbx_pipeline final : public pipeline_processor {
-
-public:
-    fbx_pipeline(std::string name, cmd_options* options)
-        : pipeline_processor(name, options)
-    {
-        SetInputCount_(1);  // <bool> discarded
-        SetOutputCount_(1); // <bool> discarded
-    }
-
-    virtual ~fbx_pipeline()
-    {
-
-    }
-
-protected:
-    virtual void Process_(DSPatch::SignalBus const& inputs, DSPatch::SignalBus& outputs) override
-    {
-        // just return immediately when there's critical error in previous component
-        const auto discarded = inputs.GetValue<bool>(0);
-        if (discarded && *discarded) {
-            return;
-        }
-
-        AVATAR_PIPELINE_LOG("[INFO] fbx_pipeline start");
-
-        const std::string output = options->output;
-
-        if (options->debug) {
-            options->output = path_without_extension(options->output).u8string() + ".fbx2glb.glb";
-        }
-
-        circuit->Tick(DSPatch::Component::TickMode::Series);
-       
-        outputs.SetValue(0, tick_result->is_discarded());
-
-        if (!tick_result->is_discarded()) {
-            AVATAR_PIPELINE_LOG("[INFO] fbx_pipeline finished without errors");
-
-            // redirect fbx pipeline output to next input. assuming gltf_pipeline is executed next
-            options->input = options->output;
-            options->output = output;
-        }
-    }
-};
-
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "DSPatch.h"
+#include "pipelines.hpp"
+#include <string>
+#include <iostream>
+#include <vector>
+
+namespace AvatarBuild {
+
+class fbx_pipeline final : public pipeline_processor {
+
+public:
+    fbx_pipeline(std::string name, job_context* context)
+        : pipeline_processor(name, context)
+    {
+        SetInputCount_(3);  // <bool> discarded, (unused), <job_context*> upstream context
+        SetOutputCount_(3); // <bool> discarded, (unused), <job_context*> context
+    }
+
+    virtual ~fbx_pipeline()
+    {
+
+    }
+
+protected:
+    virtual void Process_(DSPatch::SignalBus const& inputs, DSPatch::SignalBus& outputs) override
+    {
+        // just return immediately when there's critical error in previous component
+        const auto discarded = inputs.GetValue<bool>(0);
+        if (discarded && *discarded) {
+            return;
+        }
+
+        inherit_context(inputs, outputs);
+
+        trace_scope trace(name, "pipeline");
+        trace.arg("input", context->input);
+        trace.arg("output", context->output);
+
+        if (restore_cached(outputs)) {
+            return;
+        }
+
+        // fbx2gltf is external tool working on files
+        if (context->memory != nullptr) {
+            AVATAR_PIPELINE_LOG("[ERROR] fbx_pipeline is not supported for in-memory input");
+            outputs.SetValue(0, true);
+            return;
+        }
+
+        AVATAR_PIPELINE_LOG("[INFO] fbx_pipeline start");
+
+        const std::string output = context->output;
+
+        if (context->options->debug) {
+            context->output = path_without_extension(context->output).u8string() + ".fbx2glb.glb";
+        }
+
+        circuit->Tick(DSPatch::Component::TickMode::Series);
+       
+        outputs.SetValue(0, tick_result->is_discarded());
+
+        if (!tick_result->is_discarded()) {
+            AVATAR_PIPELINE_LOG("[INFO] fbx_pipeline finished without errors");
+
+            // redirect fbx pipeline output to next input. assuming gltf_pipeline is executed next
+            context->input = context->output;
+            context->output = output;
+
+            store_cached({ context->input });
+        }
+    }
+};
+
 } // namespace Avatar
\ No newline at end of file
@@ -1,173 +1,279 @@
-/* avatar-build is distributed under MIT license:
- *
- * Copyright (c) 2021 Kota Iguchi
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
- * SOFTWARE.
- */
-#pragma once
-
-#include "gltfpackapi.h"
-#include "pipelines.hpp"
-#include <DSPatch.h>
-#include <iostream>
-
-namespace DSPatch {
-
-class gltfpack_execute final : public Component {
-
-public:
-    gltfpack_execute(AvatarBuild::cmd_options* options)
-        : Component()
-        , options(options)
-    {
-        SetInputCount_(1);
-        SetOutputCount_(1);
-    }
-
-    virtual ~gltfpack_execute()
-    {
-    }
-
-protected:
-    json select_value(std::string name, json item, json items_defaults)
-    {
-        return item[name].is_null() ? items_defaults[name] : item[name];
-    }
-
-    Settings defaults(json item, json items_defaults)
-    {
-        Settings settings = {};
-        settings.quantize = false;
-        settings.pos_bits = 14;
-        settings.tex_bits = 12;
-        settings.nrm_bits = 8;
-        settings.col_bits = 8;
-        settings.trn_bits = 16;
-        settings.rot_bits = 12;
-        settings.scl_bits = 16;
-        settings.anim_freq = 30;
-        settings.simplify_threshold = 1.f;
-        settings.simplify_aggressive = false;
-        settings.texture_quality = 8;
-        settings.texture_scale = 1.f;
-        settings.verbose = false;
-
-        settings.keep_extras = true;
-        settings.keep_materials = false;
-        settings.keep_nodes = false;
-
-        settings.use_uint8_joints = false;
-        settings.use_uint8_weights = false;
-
-        auto simplify_threshold = select_value("simplify_threshold", item, items_defaults);
-        auto simplify_aggressive = select_value("simplify_aggressive", item, items_defaults);
-        auto quantize = select_value("quantize", item, items_defaults);
-        auto verbose = select_value("verbose", item, items_defaults);
-        auto keep_extras = select_value("keep_extras", item, items_defaults);
-        auto keep_materials = select_value("keep_materials", item, items_defaults);
-        auto keep_nodes = select_value("keep_nodes", item, items_defaults);
-        auto use_uint8_joints = select_value("use_uint8_joints", item, items_defaults);
-        auto use_uint8_weights = select_value("use_uint8_weights", item, items_defaults);
-
-        if (simplify_threshold.is_number())
-            settings.simplify_threshold = simplify_threshold.get<float>();
-
-        if (simplify_aggressive.is_boolean())
-            settings.simplify_aggressive = simplify_aggressive.get<bool>();
-
-        if (quantize.is_boolean())
-            settings.quantize = quantize.get<bool>();
-
-        if (verbose.is_boolean())
-            settings.verbose = verbose.get<bool>();
-
-        if (keep_extras.is_boolean())
-            settings.keep_extras = keep_extras.get<bool>();
-
-        if (keep_materials.is_boolean())
-            settings.keep_materials = keep_materials.get<bool>();
-
-        if (keep_nodes.is_boolean())
-            settings.keep_nodes = keep_nodes.get<bool>();
-
-        if (use_uint8_joints.is_boolean())
-            settings.use_uint8_joints = use_uint8_joints.get<bool>();
-
-        if (use_uint8_weights.is_boolean())
-            settings.use_uint8_weights = use_uint8_weights.get<bool>();
-
-        return settings;
-    }
-
-    virtual void Process_(SignalBus const& inputs, SignalBus& outputs) override
-    {
-        // just return immediately when there's critical error in previous component
-        const auto discarded = inputs.GetValue<bool>(0);
-        if (discarded && *discarded) {
-            return;
-        }
-        AVATAR_PIPELINE_LOG("[INFO] gltfpack_execute");
-
-        options->input_override.clear();
-        options->output_override.clear();
-
-        size_t count = 0;
-        const auto gltfpack_obj = options->output_config_json["gltfpack"];
-        if (gltfpack_obj.is_object()) {
-            const auto items = gltfpack_obj["LOD"];
-            const auto items_defaults = gltfpack_obj["defaults"];
-            if (items.is_array()) {
-                const auto size = items.size();
-                for (size_t i = 0; i < size; ++i) {
-                    const auto item = items[i];
-                    const auto name_LOD = item["name"].is_string() ? item["name"].get<std::string>() : "LOD" + std::to_string(i);
-                    const auto output_LOD = path_without_extension(options->output).u8string() + "." + name_LOD + fs::path(options->output).extension().u8string();
-                    const auto output_LOD_char = output_LOD.c_str();
-
-                    // use options->output for source assuming gltf_pipeline is executed before gltfpack
-                    if (gltfpack(options->output.c_str(), output_LOD_char, nullptr, defaults(item, items_defaults)) != 0) {
-                        AVATAR_PIPELINE_LOG("[ERROR] failed to execute gltfpack for " << name_LOD << ". Skipping.");
-                    } else {
-                        cgltf_data* data = nullptr;
-                        auto result = cgltf_parse_file(&options->gltf_options, output_LOD_char, &data);
-
-                        if (result == cgltf_result_success && cgltf_validate(data) == cgltf_result_success) {
-                            if (options->debug) {
-                                gltf_write_json(&options->gltf_options, data, output_LOD + ".json");
-                            }
-                            options->input_override.push_back(output_LOD);
-                            options->output_override.push_back(output_LOD);                        
-                            ++count;                        
-                        } else {
-                            AVATAR_PIPELINE_LOG("[ERROR] failed to validate " << output_LOD << ". result:" << result);
-                        }
-
-                        if (data != nullptr)
-                            cgltf_free(data);
-                    }
-                }
-            }
-        }
-
-        outputs.SetValue(0, count == 0); // discarded
-    }
-    AvatarBuild::cmd_options* options;
-};
-
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "gltfpackapi.h"
+#include "pipelines.hpp"
+#include <DSPatch.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace DSPatch {
+
+class gltfpack_execute final : public Component {
+
+public:
+    gltfpack_execute(AvatarBuild::job_context* context)
+        : Component()
+        , context(context)
+    {
+        SetInputCount_(1);
+        SetOutputCount_(1);
+    }
+
+    virtual ~gltfpack_execute()
+    {
+    }
+
+protected:
+    static fs::path temp_directory()
+    {
+        static std::atomic<uint64_t> counter { 0 };
+        std::ostringstream name;
+        name << "avatar-build-" << std::this_thread::get_id() << "-" << std::chrono::steady_clock::now().time_since_epoch().count() << "-" << counter++;
+
+        const auto dir = fs::temp_directory_path() / name.str();
+        fs::create_directories(dir);
+        return dir;
+    }
+
+#if !defined(AVATARBUILD_GLTFPACK_PARALLEL)
+    // gltfpack() of the bundled meshoptimizer is not known to be reentrant (meshoptimizer encoder
+    // versions are process-wide, texture processing uses temporary files), so concurrent jobs take
+    // turns unless the build says otherwise (AVATARBUILD_GLTFPACK_PARALLEL).
+    static std::mutex& gltfpack_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+#endif
+
+    json select_value(std::string name, json item, json items_defaults)
+    {
+        return item[name].is_null() ? items_defaults[name] : item[name];
+    }
+
+    Settings defaults(json item, json items_defaults)
+    {
+        Settings settings = {};
+        settings.quantize = false;
+        settings.pos_bits = 14;
+        settings.tex_bits = 12;
+        settings.nrm_bits = 8;
+        settings.col_bits = 8;
+        settings.trn_bits = 16;
+        settings.rot_bits = 12;
+        settings.scl_bits = 16;
+        settings.anim_freq = 30;
+        settings.simplify_threshold = 1.f;
+        settings.simplify_aggressive = false;
+        settings.texture_quality = 8;
+        settings.texture_scale = 1.f;
+        settings.verbose = false;
+
+        settings.keep_extras = true;
+        settings.keep_materials = false;
+        settings.keep_nodes = false;
+
+        settings.use_uint8_joints = false;
+        settings.use_uint8_weights = false;
+
+        auto simplify_threshold = select_value("simplify_threshold", item, items_defaults);
+        auto simplify_aggressive = select_value("simplify_aggressive", item, items_defaults);
+        auto quantize = select_value("quantize", item, items_defaults);
+        auto verbose = select_value("verbose", item, items_defaults);
+        auto keep_extras = select_value("keep_extras", item, items_defaults);
+        auto keep_materials = select_value("keep_materials", item, items_defaults);
+        auto keep_nodes = select_value("keep_nodes", item, items_defaults);
+        auto use_uint8_joints = select_value("use_uint8_joints", item, items_defaults);
+        auto use_uint8_weights = select_value("use_uint8_weights", item, items_defaults);
+
+        if (simplify_threshold.is_number())
+            settings.simplify_threshold = simplify_threshold.get<float>();
+
+        if (simplify_aggressive.is_boolean())
+            settings.simplify_aggressive = simplify_aggressive.get<bool>();
+
+        if (quantize.is_boolean())
+            settings.quantize = quantize.get<bool>();
+
+        if (verbose.is_boolean())
+            settings.verbose = verbose.get<bool>();
+
+        if (keep_extras.is_boolean())
+            settings.keep_extras = keep_extras.get<bool>();
+
+        if (keep_materials.is_boolean())
+            settings.keep_materials = keep_materials.get<bool>();
+
+        if (keep_nodes.is_boolean())
+            settings.keep_nodes = keep_nodes.get<bool>();
+
+        if (use_uint8_joints.is_boolean())
+            settings.use_uint8_joints = use_uint8_joints.get<bool>();
+
+        if (use_uint8_weights.is_boolean())
+            settings.use_uint8_weights = use_uint8_weights.get<bool>();
+
+        return settings;
+    }
+
+    virtual void Process_(SignalBus const& inputs, SignalBus& outputs) override
+    {
+        // just return immediately when there's critical error in previous component
+        const auto discarded = inputs.GetValue<bool>(0);
+        if (discarded && *discarded) {
+            return;
+        }
+        AVATAR_PIPELINE_LOG("[INFO] gltfpack_execute");
+        AvatarBuild::trace_scope trace("gltfpack_execute", "component");
+
+        context->input_override.clear();
+        context->output_override.clear();
+
+        size_t count = 0;
+        json output_config = context->options->output_config_json;
+        const auto gltfpack_obj = output_config["gltfpack"];
+        if (gltfpack_obj.is_object()) {
+            const auto items = gltfpack_obj["LOD"];
+            const auto items_defaults = gltfpack_obj["defaults"];
+            if (items.is_array()) {
+                const auto size = items.size();
+
+                std::vector<std::string> names_LOD(size);
+                std::vector<std::string> outputs_LOD(size);
+                std::vector<Settings> settings_LOD(size);
+                std::vector<int> results_LOD(size, -1);
+                for (size_t i = 0; i < size; ++i) {
+                    const auto item = items[i];
+                    names_LOD[i] = item["name"].is_string() ? item["name"].get<std::string>() : "LOD" + std::to_string(i);
+                    outputs_LOD[i] = path_without_extension(context->output).u8string() + "." + names_LOD[i] + fs::path(context->output).extension().u8string();
+                    settings_LOD[i] = defaults(item, items_defaults);
+                }
+
+                // use context->input for source assuming gltf_pipeline is executed before gltfpack
+                // (it's the same as output in a chain, but branches have their own output)
+                std::string source = context->input;
+                std::vector<std::string> files_LOD = outputs_LOD;
+
+                // gltfpack only works with files, in-memory job goes through a temporary directory
+                fs::path temp_dir;
+                if (context->memory != nullptr) {
+                    temp_dir = temp_directory();
+                    source = (temp_dir / "input.glb").u8string();
+                    for (size_t i = 0; i < size; ++i) {
+                        files_LOD[i] = (temp_dir / (std::to_string(i) + ".glb")).u8string();
+                    }
+                    if (!context->memory->export_file(context->input, source)) {
+                        AVATAR_PIPELINE_LOG("[ERROR] failed to write temporary file for gltfpack " << source);
+                        std::error_code ec;
+                        fs::remove_all(temp_dir, ec);
+                        outputs.SetValue(0, true);
+                        return;
+                    }
+                }
+
+                std::atomic<size_t> next { 0 };
+                const auto run_LODs = [&]() {
+                    for (size_t i = next++; i < size; i = next++) {
+                        AvatarBuild::trace_scope trace_LOD("gltfpack " + names_LOD[i], "process");
+                        trace_LOD.arg_file("input", source);
+                        results_LOD[i] = gltfpack(source.c_str(), files_LOD[i].c_str(), nullptr, settings_LOD[i]);
+                        trace_LOD.arg_file("output", files_LOD[i]);
+                    }
+                };
+#if defined(AVATARBUILD_GLTFPACK_PARALLEL)
+                // LODs are independent from each other. They run on their own threads, up to one per LOD and hardware
+                // thread, not on the geometry pool: --threads defaults to the hardware and the pool may be busy with other jobs.
+                const size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+                const size_t workers = std::min<size_t>(size, hardware);
+                std::vector<std::future<void>> futures;
+                for (size_t i = 1; i < workers; ++i) {
+                    futures.push_back(std::async(std::launch::async, run_LODs));
+                }
+                run_LODs();
+                for (auto& future : futures) {
+                    future.get();
+                }
+#else
+                // one gltfpack at a time: LODs run in order on this thread, extra threads would only wait for the lock.
+                // Trace spans start once the lock is taken so that waiting for other jobs is not counted as LOD time.
+                {
+                    std::lock_guard<std::mutex> lock(gltfpack_mutex());
+                    run_LODs();
+                }
+#endif
+
+                if (context->memory != nullptr) {
+                    for (size_t i = 0; i < size; ++i) {
+                        if (results_LOD[i] == 0 && !context->memory->import_file(files_LOD[i], outputs_LOD[i])) {
+                            results_LOD[i] = -1;
+                        }
+                    }
+                    std::error_code ec;
+                    fs::remove_all(temp_dir, ec);
+                }
+
+                // validation stays on this thread so that overrides are in LOD order
+                for (size_t i = 0; i < size; ++i) {
+                    const auto& name_LOD = names_LOD[i];
+                    const auto& output_LOD = outputs_LOD[i];
+
+                    if (results_LOD[i] != 0) {
+                        AVATAR_PIPELINE_LOG("[ERROR] failed to execute gltfpack for " << name_LOD << ". Skipping.");
+                    } else {
+                        cgltf_data* data = nullptr;
+                        AvatarBuild::trace_scope trace_validate("validate " + name_LOD, "file");
+                        trace_validate.arg_file("input", output_LOD);
+                        auto result = gltf_parse_file(&context->options->gltf_options, output_LOD, context->memory, &data);
+
+                        if (result == cgltf_result_success && cgltf_validate(data) == cgltf_result_success) {
+                            if (context->options->debug) {
+                                gltf_write_json(&context->options->gltf_options, data, output_LOD + ".json");
+                            }
+                            context->input_override.push_back(output_LOD);
+                            context->output_override.push_back(output_LOD);                        
+                            ++count;                        
+                        } else {
+                            AVATAR_PIPELINE_LOG("[ERROR] failed to validate " << output_LOD << ". result:" << result);
+                        }
+
+                        if (data != nullptr)
+                            gltf_free_data(data);
+                    }
+                }
+            }
+        }
+
+        outputs.SetValue(0, count == 0); // discarded
+    }
+    AvatarBuild::job_context* context;
+};
+
 } // namespace DSPatch
\ No newline at end of file
@@ -1,57 +1,58 @@
-/* avatar-build is distributed under MIT license:
- *
- * Copyright (c) 2021 Kota Iguchi
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
- * SOFTWARE.
- */
-#pragma once
-
-#include <iostream>
-#include "DSPatch.h"
-#include "pipelines.hpp"
-
-namespace DSPatch {
-
-class noop final : public Component {
-
-public:
-    noop(AvatarBuild::cmd_options* options, std::string name)
-        : Component()
-        , options(options)
-        , name(name)
-    {
-
-    }
-
-    virtual ~noop()
-    {    
-    
-    }
-
-protected:
-    virtual void Process_(SignalBus const&, SignalBus&) override
-    {
-        AVATAR_PIPELINE_LOG("[WARN] No Component is found for '" << name << "'");    
-    }
-
-    AvatarBuild::cmd_options* options;
-    std::string name;
-};
-
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <iostream>
+#include "DSPatch.h"
+#include "pipelines.hpp"
+
+namespace DSPatch {
+
+class noop final : public Component {
+
+public:
+    noop(AvatarBuild::job_context* context, std::string name)
+        : Component()
+        , context(context)
+        , name(name)
+    {
+
+    }
+
+    virtual ~noop()
+    {    
+    
+    }
+
+protected:
+    virtual void Process_(SignalBus const&, SignalBus&) override
+    {
+        AVATAR_PIPELINE_LOG("[WARN] No Component is found for '" << name << "'");    
+        AvatarBuild::trace_scope trace(name, "component");
+    }
+
+    AvatarBuild::job_context* context;
+    std::string name;
+};
+
 } // namespace DSPatch
\ No newline at end of file
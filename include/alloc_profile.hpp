@@ -0,0 +1,249 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace AvatarBuild {
+
+struct alloc_stats {
+    uint64_t runs;
+    uint64_t allocations;
+    uint64_t bytes;      // total bytes allocated
+    uint64_t peak_bytes; // peak live bytes
+};
+
+// Peak resident set size of the process in bytes
+static uint64_t alloc_peak_rss()
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return (uint64_t)counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss; // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024; // kilobytes
+#endif
+#endif
+}
+
+// Counts allocations made through gltf_calloc and cgltf memory hooks. Every block is prefixed with
+// its size so that frees are accounted too, which means profiler must stay enabled from the first
+// allocation to the last free. Process totals are atomic, per-scope stats live on the allocating thread.
+class alloc_profiler {
+public:
+    static const size_t header_size = 16; // keeps malloc alignment
+
+    struct scope_stats {
+        scope_stats* parent;
+        uint64_t allocations;
+        uint64_t bytes;
+        int64_t live;
+        int64_t peak;
+    };
+
+    alloc_profiler()
+        : allocations(0)
+        , bytes(0)
+        , live(0)
+        , peak(0)
+    {
+    }
+
+    static scope_stats*& current()
+    {
+        static thread_local scope_stats* scope = nullptr;
+        return scope;
+    }
+
+    // raw: block of size + header_size bytes, returns pointer for the caller
+    void* on_alloc(void* raw, size_t size)
+    {
+        if (raw == nullptr)
+            return nullptr;
+
+        memcpy(raw, &size, sizeof(size));
+
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+        const int64_t now = live.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+        int64_t prev = peak.load(std::memory_order_relaxed);
+        while (now > prev && !peak.compare_exchange_weak(prev, now, std::memory_order_relaxed)) {
+        }
+
+        for (auto scope = current(); scope != nullptr; scope = scope->parent) {
+            scope->allocations++;
+            scope->bytes += size;
+            scope->live += (int64_t)size;
+            scope->peak = std::max(scope->peak, scope->live);
+        }
+
+        return (uint8_t*)raw + header_size;
+    }
+
+    // returns raw block to release
+    void* on_free(void* ptr)
+    {
+        if (ptr == nullptr)
+            return nullptr;
+
+        void* raw = (uint8_t*)ptr - header_size;
+        size_t size;
+        memcpy(&size, raw, sizeof(size));
+
+        live.fetch_sub((int64_t)size, std::memory_order_relaxed);
+
+        // memory allocated by upstream scope and released here lowers the live bytes of this scope
+        for (auto scope = current(); scope != nullptr; scope = scope->parent) {
+            scope->live -= (int64_t)size;
+        }
+
+        return raw;
+    }
+
+    void add(const std::string& category, const std::string& name, const scope_stats& stats)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& result = results[category][name];
+        result.runs++;
+        result.allocations += stats.allocations;
+        result.bytes += stats.bytes;
+        result.peak_bytes = std::max(result.peak_bytes, (uint64_t)std::max<int64_t>(stats.peak, 0));
+    }
+
+    nlohmann::json report()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        nlohmann::json json_report = {
+            { "total", {
+                { "allocations", allocations.load() },
+                { "bytes", bytes.load() },
+                { "peak_bytes", (uint64_t)std::max<int64_t>(peak.load(), 0) } } },
+            { "peak_rss_bytes", alloc_peak_rss() }
+        };
+        for (const auto& category : results) {
+            for (const auto& item : category.second) {
+                json_report[category.first][item.first] = {
+                    { "runs", item.second.runs },
+                    { "allocations", item.second.allocations },
+                    { "bytes", item.second.bytes },
+                    { "peak_bytes", item.second.peak_bytes }
+                };
+            }
+        }
+        return json_report;
+    }
+
+    void print()
+    {
+        const auto json_report = report();
+        const auto megabytes = [](const nlohmann::json& value) {
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(1) << value.get<uint64_t>() / (1024.0 * 1024.0) << "MB";
+            return ss.str();
+        };
+        for (const auto& category : { "job", "pipeline", "component" }) {
+            if (!json_report.contains(category))
+                continue;
+            for (const auto& item : json_report[category].items()) {
+                const auto& stats = item.value();
+                std::cout << "[MEMORY] " << category << " " << item.key() << ": " << stats["allocations"] << " allocations, "
+                          << megabytes(stats["bytes"]) << " allocated, " << megabytes(stats["peak_bytes"]) << " peak" << std::endl;
+            }
+        }
+        const auto& total = json_report["total"];
+        std::cout << "[MEMORY] total: " << total["allocations"] << " allocations, " << megabytes(total["bytes"]) << " allocated, "
+                  << megabytes(total["peak_bytes"]) << " peak, " << megabytes(json_report["peak_rss_bytes"]) << " peak RSS" << std::endl;
+    }
+
+private:
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> bytes;
+    std::atomic<int64_t> live;
+    std::atomic<int64_t> peak;
+
+    std::mutex mutex;
+    std::map<std::string, std::map<std::string, alloc_stats>> results; // category, name
+};
+
+} // namespace AvatarBuild
+
+static AvatarBuild::alloc_profiler* pipeline_alloc_profiler = nullptr; // nullptr: allocation profiler is disabled
+
+namespace AvatarBuild {
+
+// Accounts allocations made on this thread while in scope. Scopes nest, so pipeline stats include
+// its components. Peak is the highest live bytes above the point where the scope started.
+class alloc_scope {
+public:
+    alloc_scope(const std::string& category, const std::string& name)
+        : enabled(pipeline_alloc_profiler != nullptr)
+    {
+        if (!enabled)
+            return;
+        this->category = category;
+        this->name = name;
+        stats = { alloc_profiler::current(), 0, 0, 0, 0 };
+        alloc_profiler::current() = &stats;
+    }
+
+    ~alloc_scope()
+    {
+        if (!enabled)
+            return;
+        alloc_profiler::current() = stats.parent;
+        pipeline_alloc_profiler->add(category, name, stats);
+    }
+
+    bool enabled;
+    std::string category;
+    std::string name;
+    alloc_profiler::scope_stats stats;
+};
+
+} // namespace AvatarBuild
@@ -0,0 +1,89 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+// Everything avatar-build is made of, including the implementations of single header libraries.
+// Include from exactly one translation unit of an executable (avatar-build, avatar-bench).
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#include "CLI11.hpp"
+#include "DSPatch.h"
+#include "json.hpp"
+
+#define CGLTF_IMPLEMENTATION
+#define CGLTF_WRITE_IMPLEMENTATION
+#define CGLTF_VRM_v0_0
+#define CGLTF_VRM_v0_0_IMPLEMENTATION
+#include "cgltf_write.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4458) // declaration of 'source' hides class member
+#include "verbalexpressions.hpp"
+#pragma warning(pop)
+
+#include <ghc/filesystem.hpp>
+
+namespace fs = ghc::filesystem;
+using json = nlohmann::json;
+
+#include "pipelines.hpp"
+#include "simd_func.inl"
+#include "parallel_func.inl"
+#include "mesh_index_func.inl"
+#include "gltf_func.inl"
+#include "skinning_func.inl"
+#include "gltf_overrides_func.inl"
+#include "json_func.inl"
+#include "bones_func.inl"
+#include "vrm0_func.inl"
+
+#include "glb_T_pose.hpp"
+#include "glb_jpeg_to_png.hpp"
+#include "glb_fix_roll.hpp"
+#include "glb_transforms_apply.hpp"
+#include "glb_z_reverse.hpp"
+#include "glb_overrides.hpp"
+#include "vrm0_fix_joint_buffer.hpp"
+#include "vrm0_default_extensions.hpp"
+#include "vrm0_remove_extensions.hpp"
+#include "gltf_pipeline.hpp"
+#include "gltfpack_execute.hpp"
+#include "gltfpack_pipeline.hpp"
+#include "noop.hpp"
+
+#include "fbx2gltf_execute.hpp"
+#include "fbx_pipeline.hpp"
+
+using namespace AvatarBuild;
+
+using json = nlohmann::json;
+
+#include "pipeline_func.inl"
@@ -0,0 +1,92 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef AVATARBUILD_H
+#define AVATARBUILD_H
+
+/*
+ * libavatarbuild: runs avatar-build pipelines on GLB bytes in memory.
+ *
+ *   avatar_build_result* result = avatar_build_run(glb, glb_size, pipeline_json, input_config_json, output_config_json, NULL);
+ *   if (avatar_build_result_success(result)) {
+ *       for (size_t i = 0; i < avatar_build_result_count(result); ++i) {
+ *           size_t size;
+ *           const uint8_t* data = avatar_build_result_data(result, i, &size);
+ *           // avatar_build_result_name(result, i): "output.glb", "output.LOD0.glb" ...
+ *       }
+ *   }
+ *   avatar_build_result_free(result);
+ *
+ * Pipeline definition and configs are the same JSON as pipelines/ and models/ files. Output files
+ * are named after output_name ("output.glb" when NULL), the final output comes first followed by
+ * LODs and other files written by the pipelines. fbx pipelines are not supported since fbx2gltf
+ * only works with files. Files referenced from configs (e.g. textures) are resolved from the
+ * current working directory. Jobs can run on multiple threads at the same time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(WIN32) || defined(_WIN32)
+#ifdef AVATARBUILD_EXPORTS
+#define AVATARBUILD_API __declspec(dllexport)
+#elif defined(AVATARBUILD_SHARED)
+#define AVATARBUILD_API __declspec(dllimport)
+#else
+#define AVATARBUILD_API
+#endif
+#else
+#define AVATARBUILD_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct avatar_build_result avatar_build_result;
+
+/* Runs pipeline on GLB bytes. Config JSON may be NULL. Never returns NULL, check avatar_build_result_success(). */
+AVATARBUILD_API avatar_build_result* avatar_build_run(const uint8_t* input, size_t input_size, const char* pipeline_json,
+    const char* input_config_json, const char* output_config_json, const char* output_name);
+
+AVATARBUILD_API int avatar_build_result_success(const avatar_build_result* result);
+
+/* Error message when the job failed, empty string otherwise */
+AVATARBUILD_API const char* avatar_build_result_error(const avatar_build_result* result);
+
+AVATARBUILD_API size_t avatar_build_result_count(const avatar_build_result* result);
+AVATARBUILD_API const char* avatar_build_result_name(const avatar_build_result* result, size_t index);
+AVATARBUILD_API const uint8_t* avatar_build_result_data(const avatar_build_result* result, size_t index, size_t* size);
+
+AVATARBUILD_API void avatar_build_result_free(avatar_build_result* result);
+
+/* Process-wide settings, same as --threads, --simd and --verbose. Set them before running jobs,
+ * except for the thread count which applies to geometry passes started after the call. */
+AVATARBUILD_API void avatar_build_set_threads(size_t threads);
+AVATARBUILD_API void avatar_build_set_simd(int enabled);
+AVATARBUILD_API void avatar_build_set_verbose(int enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVATARBUILD_H */
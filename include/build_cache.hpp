@@ -0,0 +1,314 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define AVATAR_BUILD_VERSION "0.1.0"
+
+namespace AvatarBuild {
+
+// FNV-1a, good enough to tell builds apart in a local cache
+struct build_cache_hash {
+    uint64_t value = 14695981039346656037ULL;
+
+    void update(const void* data, size_t size)
+    {
+        const auto bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i) {
+            value ^= bytes[i];
+            value *= 1099511628211ULL;
+        }
+    }
+
+    // strings are prefixed with their length so that ("ab", "c") differs from ("a", "bc")
+    void update(const std::string& str)
+    {
+        const uint64_t size = str.size();
+        update(&size, sizeof(size));
+        update(str.data(), str.size());
+    }
+
+    bool update_file(const std::string& path)
+    {
+        std::ifstream fin(path, std::ios::in | std::ios::binary);
+        if (fin.fail()) {
+            update(std::string("<missing>"));
+            return false;
+        }
+        std::vector<char> chunk(1 << 16);
+        while (fin) {
+            fin.read(chunk.data(), chunk.size());
+            update(chunk.data(), (size_t)fin.gcount());
+        }
+        return true;
+    }
+
+    std::string hex() const
+    {
+        std::ostringstream ss;
+        ss << std::hex;
+        ss.width(16);
+        ss.fill('0');
+        ss << value;
+        return ss.str();
+    }
+};
+
+// Job state after a pipeline finished, see job_context
+struct build_cache_state {
+    std::string input;
+    std::string output;
+    std::vector<std::string> input_override;
+    std::vector<std::string> output_override;
+};
+
+// On-disk cache of files produced by pipelines. Every entry is a directory named by its key
+// holding the files and entry.json, evicted in least recently used order when the cache
+// grows over max_bytes. Shared between jobs, all methods are thread safe.
+// Entry sizes and last uses are read from the directory once and kept in memory, so a cache
+// directory is meant for one avatar-build process at a time: entries stored by another process
+// are neither counted nor evicted until the next start.
+class build_cache {
+public:
+    build_cache(std::string dir, uint64_t max_bytes)
+        : dir(dir)
+        , max_bytes(max_bytes)
+        , total_size(0)
+    {
+        fs::create_directories(dir);
+
+        std::error_code ec;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            const auto entry_file = it->path() / "entry.json";
+            std::error_code entry_ec;
+            if (!it->is_directory(entry_ec) || !fs::exists(entry_file, entry_ec))
+                continue;
+
+            entry_info info = { fs::last_write_time(entry_file, entry_ec), 0 };
+            for (fs::directory_iterator file(it->path(), entry_ec); !entry_ec && file != end; file.increment(entry_ec)) {
+                std::error_code file_ec;
+                if (file->is_regular_file(file_ec))
+                    info.size += file->file_size(file_ec);
+            }
+            entries[it->path().filename().u8string()] = info;
+            total_size += info.size;
+        }
+    }
+
+    // True when the entry exists. It is then kept from eviction until unpin(), so that a job
+    // planned around it can still restore it later.
+    bool pin(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.count(key) == 0)
+            return false;
+        ++pinned[key];
+        return true;
+    }
+
+    void unpin(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = pinned.find(key);
+        if (it != pinned.end() && --it->second == 0)
+            pinned.erase(it);
+    }
+
+    // Copies cached files back to where they were produced
+    bool restore(const std::string& key, build_cache_state* state)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const fs::path entry_dir = fs::path(dir) / key;
+        nlohmann::json entry;
+        std::ifstream fin((entry_dir / "entry.json").u8string(), std::ios::in);
+        if (fin.fail())
+            return false;
+
+        entry = nlohmann::json::parse(fin, nullptr, false);
+        if (!entry.is_object() || !entry["files"].is_array())
+            return false;
+
+        try {
+            for (auto file : entry["files"]) {
+                const fs::path target = file["path"].get<std::string>();
+                if (target.has_parent_path())
+                    fs::create_directories(target.parent_path());
+                fs::copy_file(entry_dir / file["name"].get<std::string>(), target, fs::copy_options::overwrite_existing);
+            }
+            state->input = entry["input"].get<std::string>();
+            state->output = entry["output"].get<std::string>();
+            state->input_override = entry["input_override"].get<std::vector<std::string>>();
+            state->output_override = entry["output_override"].get<std::vector<std::string>>();
+        } catch (std::exception& e) {
+            AVATAR_PIPELINE_LOG("[WARN] failed to restore build cache " << key << ": " << e.what());
+            return false;
+        }
+
+        // entry.json modification time is the last use for eviction, files are restored already
+        // even when it can't be touched (read-only cache)
+        const auto now = fs::file_time_type::clock::now();
+        std::error_code ec;
+        fs::last_write_time(entry_dir / "entry.json", now, ec);
+        const auto it = entries.find(key);
+        if (it != entries.end())
+            it->second.last_used = now;
+
+        return true;
+    }
+
+    void store(const std::string& key, const build_cache_state& state, const std::vector<std::string>& files)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const fs::path entry_dir = fs::path(dir) / key;
+        if (entries.count(key) > 0)
+            return;
+
+        // entry is complete or missing: files are written to temporary directory and renamed at last
+        std::ostringstream tmp_name;
+        tmp_name << key << ".tmp" << std::this_thread::get_id();
+        const fs::path tmp_dir = fs::path(dir) / tmp_name.str();
+
+        try {
+            fs::remove_all(tmp_dir);
+            fs::create_directories(tmp_dir);
+
+            entry_info info = { fs::file_time_type::clock::now(), 0 };
+            nlohmann::json files_obj = nlohmann::json::array();
+            for (size_t i = 0; i < files.size(); ++i) {
+                const std::string name = std::to_string(i) + fs::path(files[i]).extension().u8string();
+                fs::copy_file(files[i], tmp_dir / name, fs::copy_options::overwrite_existing);
+                info.size += fs::file_size(tmp_dir / name);
+                files_obj.push_back({ { "path", files[i] }, { "name", name } });
+            }
+
+            nlohmann::json entry = {
+                { "version", AVATAR_BUILD_VERSION },
+                { "input", state.input },
+                { "output", state.output },
+                { "input_override", state.input_override },
+                { "output_override", state.output_override },
+                { "files", files_obj }
+            };
+            std::ofstream fout((tmp_dir / "entry.json").u8string(), std::ios::out | std::ios::trunc);
+            fout << entry.dump(2) << std::endl;
+            fout.close();
+            info.size += fs::file_size(tmp_dir / "entry.json");
+
+            fs::rename(tmp_dir, entry_dir);
+            entries[key] = info;
+            total_size += info.size;
+        } catch (std::exception& e) {
+            AVATAR_PIPELINE_LOG("[WARN] failed to store build cache " << key << ": " << e.what());
+            std::error_code ec;
+            fs::remove_all(tmp_dir, ec);
+            return;
+        }
+
+        evict();
+    }
+
+private:
+    // removes least recently used entries until the cache fits in max_bytes,
+    // only the in-memory index is sorted, the directory is not scanned again
+    void evict()
+    {
+        if (total_size <= max_bytes)
+            return;
+
+        std::vector<std::pair<fs::file_time_type, std::string>> lru;
+        lru.reserve(entries.size());
+        for (const auto& entry : entries) {
+            lru.emplace_back(entry.second.last_used, entry.first);
+        }
+        std::sort(lru.begin(), lru.end());
+
+        for (const auto& entry : lru) {
+            if (total_size <= max_bytes)
+                break;
+            if (pinned.count(entry.second) > 0)
+                continue;
+            AVATAR_PIPELINE_LOG("[INFO] build cache: evicting " << entry.second);
+            std::error_code ec;
+            fs::remove_all(fs::path(dir) / entry.second, ec);
+            total_size -= entries[entry.second].size;
+            entries.erase(entry.second);
+        }
+    }
+
+    struct entry_info {
+        fs::file_time_type last_used;
+        uint64_t size;
+    };
+
+    std::string dir;
+    uint64_t max_bytes;
+    uint64_t total_size; // sum of entries sizes
+    std::unordered_map<std::string, entry_info> entries; // key -> entry on disk
+    std::mutex mutex;
+    std::unordered_map<std::string, size_t> pinned; // key -> number of jobs using it
+};
+
+// Entries pinned by a job, unpinned when the job is done
+class build_cache_pins {
+public:
+    explicit build_cache_pins(build_cache* cache)
+        : cache(cache)
+    {
+    }
+
+    ~build_cache_pins()
+    {
+        for (const auto& key : keys) {
+            cache->unpin(key);
+        }
+    }
+
+    bool pin(const std::string& key)
+    {
+        if (!cache->pin(key))
+            return false;
+        keys.push_back(key);
+        return true;
+    }
+
+private:
+    build_cache_pins(const build_cache_pins&) = delete;
+    build_cache_pins& operator=(const build_cache_pins&) = delete;
+
+    build_cache* cache;
+    std::vector<std::string> keys;
+};
+
+} // namespace AvatarBuild
@@ -20,14 +20,28 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+#include <algorithm>
+#include <atomic>
 #include <codecvt>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 
+#ifndef WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_SILENT_WARNINGS
 #include <glm/glm.hpp>
@@ -38,33 +52,169 @@
 #define GLTF_PARENT_LOOP_BEGIN(CONDITION) { std::uint16_t COUNTER=0; while (CONDITION) { ++COUNTER; if (COUNTER > 256) {AVATAR_PIPELINE_LOG("[WARNING] infinite loop detected at parent loop"); break;}
 #define GLTF_PARENT_LOOP_END }}
 
-#define gltf_calloc(N, SIZE) (pipeline_leackcheck_enabled ? stb_leakcheck_calloc(N * SIZE, __FILE__, __LINE__) : calloc(N, SIZE))
-#define gltf_free(P) (pipeline_leackcheck_enabled ? stb_leakcheck_free(P) : free(P))
+#define gltf_calloc(N, SIZE) gltf_tracked_calloc((N) * (SIZE), AvatarBuild::leak_checker::call_site { __FILE__, __LINE__, nullptr })
+#define gltf_free(P) gltf_tracked_free(P)
 
-static void* gltf_leakcheck_malloc(void* user, cgltf_size size)
+// allocations go through leak checker and allocation profiler when they are enabled
+static void* gltf_tracked_calloc(size_t size, AvatarBuild::leak_checker::call_site site)
+{
+    const size_t header_size = pipeline_alloc_profiler ? AvatarBuild::alloc_profiler::header_size : 0;
+    void* raw = pipeline_leackcheck_enabled ? pipeline_leak_checker.allocate(size + header_size, site) : calloc(1, size + header_size);
+    return pipeline_alloc_profiler ? pipeline_alloc_profiler->on_alloc(raw, size) : raw;
+}
+
+static void gltf_tracked_free(void* ptr)
+{
+    if (pipeline_alloc_profiler)
+        ptr = pipeline_alloc_profiler->on_free(ptr);
+
+    if (pipeline_leackcheck_enabled)
+        pipeline_leak_checker.release(ptr);
+    else
+        free(ptr);
+}
+
+// cgltf memory hooks, call site of cgltf allocations is the caller inside cgltf
+static void* gltf_memory_alloc(void* user, cgltf_size size)
 {
     (void)user;
-    return stb_leakcheck_malloc(size, __FILE__, __LINE__);
+    return gltf_tracked_calloc(size, { nullptr, 0, AVATAR_RETURN_ADDRESS() });
 }
 
-static void gltf_leackcheck_free(void* user, void* ptr)
+static void gltf_memory_free(void* user, void* ptr)
 {
     (void)user;
-    stb_leakcheck_free(ptr);
+    gltf_tracked_free(ptr);
+}
+
+// Bump allocator of one cgltf_data (see gltf_arena_options). JSON-level allocations of cgltf and
+// components (names, arrays, VRM properties) are carved from blocks and released at once with the
+// data, large ones (buffer payloads) go to the system allocator and are freed one by one as before.
+// Reference counted since shared buffers released through it may outlive the data.
+struct gltf_arena {
+    static const size_t alignment = 16;
+    static const size_t large_size = 16 * 1024;
+    static const size_t min_block_size = 64 * 1024;
+    static const size_t max_block_size = 1024 * 1024;
+
+    std::mutex mutex;
+    std::atomic<int> references { 1 };
+    std::vector<std::pair<uint8_t*, size_t>> blocks;
+    size_t used = 0; // bytes used in the last block
+
+    ~gltf_arena()
+    {
+        for (const auto& block : blocks)
+            gltf_free(block.first);
+    }
+
+    // zero filled like gltf_calloc
+    void* allocate(size_t size)
+    {
+        if (size >= large_size)
+            return gltf_calloc(size, sizeof(uint8_t));
+
+        size = size > 0 ? (size + alignment - 1) & ~(alignment - 1) : alignment;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (blocks.empty() || used + size > blocks.back().second) {
+            const size_t last_size = blocks.empty() ? min_block_size / 2 : blocks.back().second;
+            const size_t block_size = last_size < max_block_size ? last_size * 2 : max_block_size;
+            const auto block = (uint8_t*)gltf_calloc(block_size, sizeof(uint8_t));
+            if (block == nullptr)
+                return nullptr;
+            blocks.emplace_back(block, block_size);
+            used = 0;
+        }
+
+        const auto ptr = blocks.back().first + used;
+        used += size;
+        return ptr;
+    }
+
+    // memory in blocks is released with the arena
+    void release(void* ptr)
+    {
+        if (ptr == nullptr)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& block : blocks) {
+                if ((uint8_t*)ptr >= block.first && (uint8_t*)ptr < block.first + block.second)
+                    return;
+            }
+        }
+        gltf_free(ptr);
+    }
+};
+
+static void* gltf_arena_alloc(void* user, cgltf_size size)
+{
+    return ((gltf_arena*)user)->allocate(size);
+}
+
+static void gltf_arena_free(void* user, void* ptr)
+{
+    ((gltf_arena*)user)->release(ptr);
 }
 
-static char* gltf_alloc_chars(const char* str)
+static void gltf_arena_release(gltf_arena* arena)
+{
+    if (arena != nullptr && --arena->references == 0)
+        delete arena;
+}
+
+static gltf_arena* gltf_data_arena(const cgltf_data* data)
+{
+    if (data == nullptr || data->memory.alloc != &gltf_arena_alloc)
+        return nullptr;
+    return (gltf_arena*)data->memory.user_data;
+}
+
+// Options to parse data with its own arena. Custom allocators and leak checker (which needs every
+// allocation) are kept as they are, nullptr is returned then. Data owns the arena on success,
+// release it with gltf_arena_release() when parsing fails.
+static gltf_arena* gltf_arena_options(const cgltf_options* options, cgltf_options* out_options)
+{
+    *out_options = *options;
+    if (pipeline_leackcheck_enabled || (options->memory.alloc != nullptr && options->memory.alloc != &gltf_memory_alloc))
+        return nullptr;
+
+    const auto arena = new gltf_arena();
+    out_options->memory.alloc = &gltf_arena_alloc;
+    out_options->memory.free = &gltf_arena_free;
+    out_options->memory.user_data = arena;
+    return arena;
+}
+
+// Allocation owned by data and released by cgltf_free(), from its arena when it has one
+#define gltf_data_calloc(DATA, N, SIZE) gltf_data_alloc((DATA), (N) * (SIZE), AvatarBuild::leak_checker::call_site { __FILE__, __LINE__, nullptr })
+
+static void* gltf_data_alloc(cgltf_data* data, size_t size, AvatarBuild::leak_checker::call_site site)
+{
+    const auto arena = gltf_data_arena(data);
+    return arena != nullptr ? arena->allocate(size) : gltf_tracked_calloc(size, site);
+}
+
+// Frees memory of data allocated by cgltf or gltf_data_calloc(), gltf_free() is for the rest
+static void gltf_data_free(cgltf_data* data, void* ptr)
+{
+    data->memory.free(data->memory.user_data, ptr);
+}
+
+// Copy of str owned by data, leak check reports the caller of gltf_data_alloc_chars()
+#define gltf_data_alloc_chars(DATA, STR) gltf_data_alloc_chars_at((DATA), (STR), AvatarBuild::leak_checker::call_site { __FILE__, __LINE__, nullptr })
+
+static char* gltf_data_alloc_chars_at(cgltf_data* data, const char* str, AvatarBuild::leak_checker::call_site site)
 {
     if (str == nullptr)
         return nullptr;
 
     const auto length = strlen(str);
-    if (length == 0)
-        return (char*)gltf_calloc(1, 1);
-
-    auto dst = (char*)gltf_calloc(length + 1, sizeof(char));
+    auto dst = (char*)gltf_data_alloc(data, length + 1, site);
     if (dst != NULL)
-        strncpy(dst, str, length);
+        memcpy(dst, str, length);
 
     return dst;
 }
@@ -134,21 +284,101 @@ static cgltf_result gltf_file_read(const struct cgltf_memory_options* memory_opt
     std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
     return gltf_wstring_file_read(memory_options, file_options, converter.from_bytes(path), size, data);
 }
-#endif
 
-static void gltf_f3_min(cgltf_float* a, cgltf_float* b, cgltf_float* out)
+static bool gltf_file_is_mapped(const void* ptr)
 {
-    out[0] = a[0] < b[0] ? a[0] : b[0];
-    out[1] = a[1] < b[1] ? a[1] : b[1];
-    out[2] = a[2] < b[2] ? a[2] : b[2];
+    (void)ptr;
+    return false;
 }
+#else
+// Input files are mapped instead of read into memory, so the BIN chunk of GLB is used in place.
+// Buffer views are copied only when a component writes them (see gltf_accessor_write_data).
+static std::mutex gltf_file_mappings_mutex;
+static std::map<uintptr_t, size_t> gltf_file_mappings; // address, length
 
-static void gltf_f3_max(cgltf_float* a, cgltf_float* b, cgltf_float* out)
+static cgltf_result gltf_file_read(const struct cgltf_memory_options* memory_options, const struct cgltf_file_options* file_options, const char* path, cgltf_size* size, void** data)
+{
+    (void)memory_options, (void)file_options;
+
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return cgltf_result_file_not_found;
+    }
+
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        ::close(fd);
+        return cgltf_result_io_error;
+    }
+    const auto file_size = (cgltf_size)file_stat.st_size;
+
+    // buffer is shorter than requested, same as fread() failing in cgltf_default_file_read
+    if (size && *size > file_size) {
+        ::close(fd);
+        return cgltf_result_io_error;
+    }
+
+    // private mapping never changes the file, pages written in place anyway are copied by the kernel
+    void* file_data = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (file_data == MAP_FAILED) {
+        return cgltf_result_io_error;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(gltf_file_mappings_mutex);
+        gltf_file_mappings[(uintptr_t)file_data] = file_size;
+    }
+
+    if (size && *size == 0) {
+        *size = file_size;
+    }
+    if (data) {
+        *data = file_data;
+    }
+
+    return cgltf_result_success;
+}
+
+// cgltf releases buffers it allocated by itself through here as well
+static void gltf_file_release(const struct cgltf_memory_options* memory_options, const struct cgltf_file_options* file_options, void* data)
+{
+    (void)file_options;
+
+    if (data == nullptr)
+        return;
+
+    size_t length = 0;
+    {
+        std::lock_guard<std::mutex> lock(gltf_file_mappings_mutex);
+        const auto found = gltf_file_mappings.find((uintptr_t)data);
+        if (found != gltf_file_mappings.end()) {
+            length = found->second;
+            gltf_file_mappings.erase(found);
+        }
+    }
+
+    if (length > 0) {
+        ::munmap(data, length);
+    } else {
+        void (*memory_free)(void*, void*) = memory_options->free ? memory_options->free : &cgltf_default_free;
+        memory_free(memory_options->user_data, data);
+    }
+}
+
+// true when ptr is in a file mapped by gltf_file_read()
+static bool gltf_file_is_mapped(const void* ptr)
 {
-    out[0] = a[0] > b[0] ? a[0] : b[0];
-    out[1] = a[1] > b[1] ? a[1] : b[1];
-    out[2] = a[2] > b[2] ? a[2] : b[2];
+    const auto address = (uintptr_t)ptr;
+
+    std::lock_guard<std::mutex> lock(gltf_file_mappings_mutex);
+    auto found = gltf_file_mappings.upper_bound(address);
+    if (found == gltf_file_mappings.begin())
+        return false;
+    --found;
+    return address < found->first + found->second;
 }
+#endif
 
 static bool gltf_remove_animation(cgltf_data* data)
 {
@@ -177,6 +407,172 @@ static bool gltf_remove_animation(cgltf_data* data)
     return false;
 }
 
+// Buffer view data, private copy (buffer_view->data) takes precedence over buffer like cgltf does
+static uint8_t* gltf_buffer_view_data(const cgltf_buffer_view* buffer_view)
+{
+    if (buffer_view->data != nullptr)
+        return (uint8_t*)buffer_view->data;
+    return (uint8_t*)buffer_view->buffer->data + buffer_view->offset;
+}
+
+// Buffer payloads shared copy-on-write between cgltf_data and its clones (see gltf_clone_data).
+// Payloads are owned here once shared, and released with the last cgltf_data referring them.
+struct gltf_shared_buffers {
+    cgltf_memory_options memory;
+    cgltf_file_options file;
+    std::vector<void*> payloads; // buffer data shared between clones
+    std::vector<void*> owned;    // memory to release, glb bin chunk is a part of file data
+    gltf_arena* arena = nullptr; // memory of the source, owned may be in it
+
+    ~gltf_shared_buffers()
+    {
+        for (const auto ptr : owned) {
+            if (file.release != nullptr) {
+                file.release(&memory, &file, ptr);
+            } else {
+                memory.free(memory.user_data, ptr);
+            }
+        }
+        gltf_arena_release(arena);
+    }
+};
+
+static std::mutex gltf_shared_mutex;
+static std::unordered_map<const cgltf_data*, std::shared_ptr<gltf_shared_buffers>> gltf_shared_registry;
+
+static bool gltf_is_shared_buffer(const cgltf_data* data, const cgltf_buffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(gltf_shared_mutex);
+    const auto found = gltf_shared_registry.find(data);
+    if (found == gltf_shared_registry.end())
+        return false;
+
+    const auto& payloads = found->second->payloads;
+    return std::find(payloads.begin(), payloads.end(), buffer->data) != payloads.end();
+}
+
+// Takes over buffers of data so that they can be shared with clones. gltf_shared_mutex must be locked.
+static std::shared_ptr<gltf_shared_buffers> gltf_share_buffers(cgltf_data* data)
+{
+    auto& shared = gltf_shared_registry[data];
+    if (!shared) {
+        shared = std::make_shared<gltf_shared_buffers>();
+        shared->memory = data->memory;
+        shared->file = data->file;
+        shared->arena = gltf_data_arena(data);
+        if (shared->arena != nullptr)
+            ++shared->arena->references;
+    }
+
+    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+        const auto ptr = data->buffers[i].data;
+        if (ptr == nullptr || std::find(shared->payloads.begin(), shared->payloads.end(), ptr) != shared->payloads.end())
+            continue;
+        shared->payloads.push_back(ptr);
+        if (ptr != data->bin)
+            shared->owned.push_back(ptr);
+    }
+
+    // json and bin chunk live in file data, keep it alive as long as any clone exists
+    if (data->file_data != nullptr) {
+        shared->owned.push_back(data->file_data);
+        data->file_data = nullptr;
+    }
+
+    return shared;
+}
+
+// Returns accessor data for writing. Buffer view shared with clones or mapped from file gets a private
+// copy first, so only buffer views actually written are duplicated. Not thread safe for the same data,
+// call it before splitting work on the thread pool.
+static uint8_t* gltf_accessor_write_data(cgltf_data* data, cgltf_accessor* accessor)
+{
+    const auto buffer_view = accessor->buffer_view;
+    if (buffer_view->data == nullptr && (gltf_is_shared_buffer(data, buffer_view->buffer) || gltf_file_is_mapped(buffer_view->buffer->data))) {
+        buffer_view->data = gltf_calloc(buffer_view->size, sizeof(uint8_t));
+        memcpy(buffer_view->data, (uint8_t*)buffer_view->buffer->data + buffer_view->offset, buffer_view->size);
+    }
+    return gltf_buffer_view_data(buffer_view) + accessor->offset;
+}
+
+// Clones data without re-reading the file. JSON-level structure is written and parsed again by cgltf
+// (node, mesh etc. keep their indices), buffers are shared copy-on-write with source.
+// Source must not be modified while cloning. Release both of them with gltf_free_data().
+static bool gltf_clone_data(const cgltf_options* options, cgltf_data* source, cgltf_data** out_data)
+{
+    const cgltf_size size = cgltf_write(options, nullptr, 0, source);
+    auto json = (char*)gltf_calloc(size + 1, sizeof(char));
+    cgltf_write(options, json, size, source);
+
+    cgltf_options clone_options;
+    const auto arena = gltf_arena_options(options, &clone_options);
+    clone_options.type = cgltf_file_type_gltf;
+
+    cgltf_data* clone = nullptr;
+    const auto result = cgltf_parse(&clone_options, json, strlen(json), &clone);
+    if (result != cgltf_result_success || clone->buffers_count != source->buffers_count) {
+        AVATAR_PIPELINE_LOG("[ERROR] failed to clone glTF data");
+        if (result == cgltf_result_success)
+            cgltf_free(clone);
+        gltf_arena_release(arena);
+        gltf_free(json);
+        return false;
+    }
+
+    // clone->json points to it, released by cgltf_free()
+    clone->file_data = json;
+
+    {
+        std::lock_guard<std::mutex> lock(gltf_shared_mutex);
+        auto shared = gltf_share_buffers(source);
+        for (cgltf_size i = 0; i < clone->buffers_count; ++i) {
+            clone->buffers[i].data = source->buffers[i].data;
+        }
+        gltf_shared_registry[clone] = shared;
+    }
+
+    // buffer views already written by source are not in shared buffers
+    for (cgltf_size i = 0; i < clone->buffer_views_count && i < source->buffer_views_count; ++i) {
+        const auto from = &source->buffer_views[i];
+        if (from->data != nullptr) {
+            clone->buffer_views[i].data = gltf_calloc(from->size, sizeof(uint8_t));
+            memcpy(clone->buffer_views[i].data, from->data, from->size);
+        }
+    }
+
+    *out_data = clone;
+
+    return true;
+}
+
+// cgltf_free() that keeps buffers shared with clones alive, and releases arena of data
+static void gltf_free_data(cgltf_data* data)
+{
+    if (data == nullptr)
+        return;
+
+    const auto arena = gltf_data_arena(data);
+
+    std::shared_ptr<gltf_shared_buffers> shared;
+    {
+        std::lock_guard<std::mutex> lock(gltf_shared_mutex);
+        const auto found = gltf_shared_registry.find(data);
+        if (found != gltf_shared_registry.end()) {
+            shared = found->second;
+            gltf_shared_registry.erase(found);
+
+            for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+                const auto& payloads = shared->payloads;
+                if (std::find(payloads.begin(), payloads.end(), data->buffers[i].data) != payloads.end())
+                    data->buffers[i].data = nullptr;
+            }
+        }
+    }
+
+    cgltf_free(data);
+    gltf_arena_release(arena);
+}
+
 static bool gltf_update_joint_buffer(cgltf_accessor* joints)
 {
     // check if joint buffer needs to be updated
@@ -197,6 +593,8 @@ static bool gltf_update_joint_buffer(cgltf_accessor* joints)
         data[2] = static_cast<std::uint16_t>(out[2]);
         data[3] = static_cast<std::uint16_t>(out[3]);
     }
+    if (joints->buffer_view->data != nullptr)
+        gltf_free(joints->buffer_view->data);
     joints->buffer_view->size = new_buffer_view_size;
     joints->buffer_view->data = joints_data;
     joints->component_type = cgltf_component_type_r_16u;
@@ -204,122 +602,102 @@ static bool gltf_update_joint_buffer(cgltf_accessor* joints)
     return true;
 }
 
-static bool gltf_create_buffer(cgltf_data* data)
+static bool gltf_upcast_joints(cgltf_data* data, gltf_mesh_index& index)
 {
-    // this should not happen but for safety
-    if (data->buffers_count == 0)
-        return false;
-
-    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
-
-        auto buffer = &data->buffers[i];
-
-        cgltf_size total_size = 0;
-        for (cgltf_size j = 0; j < data->buffer_views_count; ++j) {
-            if (data->buffer_views[i].buffer == buffer) {
-                total_size += (data->buffer_views[j].size + 3) & ~3;
-            }
+    // new joints are owned by their buffer views, buffers are packed when written
+    for (const auto accessor : index.joints_accessors) {
+        if (gltf_update_joint_buffer(&data->accessors[accessor])) {
+            gltf_mesh_index_mark_dirty(index, &data->accessors[accessor]);
         }
+    }
 
-        auto buffer_data = (uint8_t*)gltf_calloc(total_size, sizeof(uint8_t)); // will be freed at cgltf_free()
-        if (buffer_data == nullptr)
-            return false;
+    return true;
+}
 
-        auto buffer_dst = buffer_data;
-        for (cgltf_size j = 0; j < data->buffer_views_count; ++j) {
-            const auto buffer_view = &data->buffer_views[j];
-            if (data->buffer_views[i].buffer == buffer) {
-                const auto size_to_copy = buffer_view->size;
-                if (buffer_view->data != nullptr) {
-                    memcpy(buffer_dst, buffer_view->data, size_to_copy);
-                } else {
-                    memcpy(buffer_dst, ((uint8_t*)buffer_view->buffer->data + buffer_view->offset), size_to_copy);
-                }
-                buffer_view->offset = (buffer_dst - buffer_data);
-                buffer_dst += (size_to_copy + 3) & ~3;
+static glm::mat4 gltf_get_node_transform(const cgltf_node* node)
+{
+    auto matrix = glm::mat4(1.0f);
+    auto translation = glm::make_vec3(node->translation);
+    auto scale = glm::make_vec3(node->scale);
+    auto rotation = glm::make_quat(node->rotation);
 
-                if (buffer_view->data != nullptr) {
-                    gltf_free(buffer_view->data);
-                    buffer_view->data = nullptr;
-                }
-            }
-        }
+    return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
+}
 
-        // check if buffer has been updated from original, need to free in that case
-        if (buffer->data != data->bin) {
-            gltf_free(buffer->data);
+// Marks node and its subtree dirty, world transforms are recomputed by gltf_get_world_transform().
+// Subtrees which are dirty already are not walked again, so posing every bone of a chain marks
+// each node once: O(n) over a pose instead of O(n * depth).
+static void gltf_world_mark_dirty(gltf_world_cache& cache, const cgltf_node* node, const cgltf_data* data)
+{
+    std::vector<const cgltf_node*> stack = { node };
+    while (!stack.empty()) {
+        const auto current = stack.back();
+        stack.pop_back();
+
+        const cgltf_size i = current - data->nodes;
+        if (cache.dirty[i])
+            continue; // subtree is dirty already
+        cache.dirty[i] = 1;
+
+        for (cgltf_size j = 0; j < current->children_count; ++j) {
+            stack.push_back(current->children[j]);
         }
-
-        buffer->size = total_size;
-        buffer->data = buffer_data;
     }
-
-    return true;
 }
 
-static bool gltf_upcast_joints(cgltf_data* data)
+static void gltf_world_mark_all_dirty(gltf_world_cache& cache)
 {
-    cgltf_size update_count = 0;
-    std::set<cgltf_accessor*> accessor_coord_done;
-    for (cgltf_size i = 0; i < data->nodes_count; ++i) {
-        const auto node = &data->nodes[i];
-        if (node->mesh == nullptr)
-            continue;
-
-        const auto mesh = node->mesh;
+    std::fill(cache.dirty.begin(), cache.dirty.end(), 1);
+}
 
-        for (cgltf_size j = 0; j < mesh->primitives_count; ++j) {
-            const auto primitive = &mesh->primitives[j];
+// World transform as world[parent] * local, computed top-down: every node is computed once from its
+// cached parent, O(n) for the whole scene and O(dirty nodes) after a pose. The old walk up the parent
+// chain multiplied leaf-up, P2 * (P1 * L), and can't reuse the parent's result; top-down (P2 * P1) * L
+// may differ from it in the last bits of a float, which is within skinning tolerance.
+static const glm::mat4& gltf_get_world_transform(gltf_world_cache& cache, const cgltf_node* node, const cgltf_data* data)
+{
+    const cgltf_size index = node - data->nodes;
+    if (!cache.dirty[index])
+        return cache.world[index];
+
+    // dirty ancestors up to the first clean one, parents have to be recomputed first
+    std::vector<const cgltf_node*> chain = { node };
+    const cgltf_node* parent = node->parent;
+    GLTF_PARENT_LOOP_BEGIN (parent != nullptr && cache.dirty[parent - data->nodes])
+        chain.push_back(parent);
+        parent = parent->parent;
+    GLTF_PARENT_LOOP_END
 
-            for (cgltf_size k = 0; k < primitive->attributes_count; ++k) {
-                const auto attr = &primitive->attributes[k];
-                const auto accessor = attr->data;
-                if (accessor_coord_done.count(accessor) > 0) {
-                    continue;
-                }
-                if (attr->name && strcmp(attr->name, "JOINTS_0") == 0) {
-                    if (gltf_update_joint_buffer(accessor))
-                        ++update_count;
-                }
-                accessor_coord_done.emplace(accessor);
-            }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        const auto current = *it;
+        const cgltf_size i = current - data->nodes;
+        if (current->parent != nullptr) {
+            cache.world[i] = cache.world[current->parent - data->nodes] * gltf_get_node_transform(current);
+        } else {
+            cache.world[i] = gltf_get_node_transform(current);
         }
+        cache.dirty[i] = 0;
     }
 
-    return (update_count > 0 ? gltf_create_buffer(data) : true);
+    return cache.world[index];
 }
 
-static void gltf_reverse_z_accessor(cgltf_accessor* accessor)
+static void gltf_reverse_z_range(cgltf_accessor* accessor, cgltf_size begin, cgltf_size end)
 {
-    uint8_t* buffer_data = (uint8_t*)accessor->buffer_view->buffer->data + accessor->buffer_view->offset + accessor->offset;
+    uint8_t* buffer_data = gltf_buffer_view_data(accessor->buffer_view) + accessor->offset;
 
-    accessor->max[0] = -FLT_MAX;
-    accessor->max[2] = -FLT_MAX;
-    accessor->min[0] = FLT_MAX;
-    accessor->min[2] = FLT_MAX;
-
-    for (cgltf_size i = 0; i < accessor->count; ++i) {
+    for (cgltf_size i = begin; i < end; ++i) {
         cgltf_float* element = (cgltf_float*)(buffer_data + (accessor->stride * i));
         element[0] = -element[0];
         element[2] = -element[2];
-
-        gltf_f3_max(element, accessor->max, accessor->max);
-        gltf_f3_min(element, accessor->min, accessor->min);
     }
 }
 
-static void gltf_apply_transform_accessor(cgltf_node* node, cgltf_accessor* accessor)
+static void gltf_apply_transform_range(cgltf_node* node, cgltf_accessor* accessor, cgltf_size begin, cgltf_size end)
 {
-    uint8_t* buffer_data = (uint8_t*)accessor->buffer_view->buffer->data + accessor->buffer_view->offset + accessor->offset;
+    uint8_t* buffer_data = gltf_buffer_view_data(accessor->buffer_view) + accessor->offset;
 
-    accessor->max[0] = -FLT_MAX;
-    accessor->max[1] = -FLT_MAX;
-    accessor->max[2] = -FLT_MAX;
-    accessor->min[0] = FLT_MAX;
-    accessor->min[1] = FLT_MAX;
-    accessor->min[2] = FLT_MAX;
-
-    for (cgltf_size i = 0; i < accessor->count; ++i) {
+    for (cgltf_size i = begin; i < end; ++i) {
         cgltf_float* element = (cgltf_float*)(buffer_data + (accessor->stride * i));
 
         if (node->has_scale) {
@@ -344,58 +722,186 @@ static void gltf_apply_transform_accessor(cgltf_node* node, cgltf_accessor* acce
             element[1] = newpos.y;
             element[2] = newpos.z;
         }
+    }
+}
 
-        gltf_f3_max(element, accessor->max, accessor->max);
-        gltf_f3_min(element, accessor->min, accessor->min);
+// Runs fn on vertex ranges of all accessors on the thread pool
+static void gltf_parallel_accessors(cgltf_data* data, const std::vector<cgltf_size>& accessors, const std::function<void(cgltf_size item, cgltf_size begin, cgltf_size end)>& fn)
+{
+    std::vector<cgltf_size> counts;
+    for (const auto accessor : accessors) {
+        counts.push_back(data->accessors[accessor].count);
     }
+
+    const auto ranges = gltf_parallel_split(counts);
+    gltf_parallel_for(ranges, [&](cgltf_size, const gltf_parallel_range& range) {
+        fn(range.item, range.begin, range.end);
+    });
 }
 
-static void gltf_reverse_z(cgltf_data* data)
+// Accumulates bounds of float elements [begin, end) into min/max per component. Elements are stride
+// bytes apart from data, available is the number of bytes which can be read from data.
+typedef void (*gltf_bounds_kernel)(const uint8_t* data, cgltf_size stride, cgltf_size components, cgltf_size begin, cgltf_size end, cgltf_size available, cgltf_float* min, cgltf_float* max);
+
+// reference implementation, NaN elements are ignored (comparisons with NaN are false)
+static void gltf_bounds_kernel_scalar(const uint8_t* data, cgltf_size stride, cgltf_size components, cgltf_size begin, cgltf_size end, cgltf_size available, cgltf_float* min, cgltf_float* max)
 {
-    std::set<cgltf_accessor*> accessor_coord_done;
-    for (cgltf_size i = 0; i < data->nodes_count; ++i) {
-        const auto node = &data->nodes[i];
-        const auto mesh = node->mesh;
+    (void)available;
+    for (cgltf_size i = begin; i < end; ++i) {
+        const cgltf_float* element = (const cgltf_float*)(data + stride * i);
+        for (cgltf_size c = 0; c < components; ++c) {
+            min[c] = element[c] < min[c] ? element[c] : min[c];
+            max[c] = element[c] > max[c] ? element[c] : max[c];
+        }
+    }
+}
+
+#if defined(GLTF_SIMD_X86)
+
+// SSE2: every element is loaded as whole 4 float columns (up to 4 for MAT4), lanes past the last
+// component are ignored. Elements whose last column would be read past available go to the scalar path.
+// minps/maxps return the second operand when either one is NaN, so the element goes first and NaN
+// elements are ignored the same way as in the scalar kernel.
+GLTF_TARGET_SSE2 static void gltf_bounds_kernel_sse2(const uint8_t* data, cgltf_size stride, cgltf_size components, cgltf_size begin, cgltf_size end, cgltf_size available, cgltf_float* min, cgltf_float* max)
+{
+    const cgltf_size columns = (components + 3) / 4;
+    if (components == 0 || columns > 4) {
+        gltf_bounds_kernel_scalar(data, stride, components, begin, end, available, min, max);
+        return;
+    }
+
+    __m128 vmin[4];
+    __m128 vmax[4];
+    for (cgltf_size c = 0; c < columns; ++c) {
+        vmin[c] = _mm_set1_ps(FLT_MAX);
+        vmax[c] = _mm_set1_ps(-FLT_MAX);
+    }
+
+    cgltf_size i = begin;
+    for (; i < end && stride * i + columns * 16 <= available; ++i) {
+        const cgltf_float* element = (const cgltf_float*)(data + stride * i);
+        for (cgltf_size c = 0; c < columns; ++c) {
+            const __m128 value = _mm_loadu_ps(element + c * 4);
+            vmin[c] = _mm_min_ps(value, vmin[c]);
+            vmax[c] = _mm_max_ps(value, vmax[c]);
+        }
+    }
+
+    alignas(16) cgltf_float lanes_min[16];
+    alignas(16) cgltf_float lanes_max[16];
+    for (cgltf_size c = 0; c < columns; ++c) {
+        _mm_store_ps(lanes_min + c * 4, vmin[c]);
+        _mm_store_ps(lanes_max + c * 4, vmax[c]);
+    }
+    for (cgltf_size c = 0; c < components; ++c) {
+        min[c] = lanes_min[c] < min[c] ? lanes_min[c] : min[c];
+        max[c] = lanes_max[c] > max[c] ? lanes_max[c] : max[c];
+    }
+
+    gltf_bounds_kernel_scalar(data, stride, components, i, end, available, min, max);
+}
+
+#endif
 
-        if (mesh == nullptr)
+static gltf_bounds_kernel gltf_select_bounds_kernel()
+{
+#if defined(GLTF_SIMD_X86)
+    if (gltf_get_simd_level() != gltf_simd_level::scalar)
+        return &gltf_bounds_kernel_sse2;
+#endif
+    return &gltf_bounds_kernel_scalar;
+}
+
+// Bounds of one accessor which isn't float (or sparse). glTF min/max of normalized integers are raw
+// component values, so they are read as if not normalized; signed types keep their sign.
+static void gltf_update_bounds_accessor(cgltf_accessor* accessor)
+{
+    const cgltf_size components = cgltf_num_components(accessor->type);
+
+    for (cgltf_size c = 0; c < components; ++c) {
+        accessor->min[c] = FLT_MAX;
+        accessor->max[c] = -FLT_MAX;
+    }
+
+    cgltf_accessor raw = *accessor;
+    raw.normalized = false;
+
+    cgltf_float element[16];
+    for (cgltf_size i = 0; i < accessor->count; ++i) {
+        cgltf_accessor_read_float(&raw, i, element, components);
+        gltf_bounds_kernel_scalar((const uint8_t*)element, 0, components, 0, 1, sizeof(element), accessor->min, accessor->max);
+    }
+}
+
+// Recomputes min/max of accessors written since the last call (see gltf_mesh_index_mark_dirty),
+// kernels only write vertex data so that bounds are computed once before validation and write.
+static void gltf_update_bounds(gltf_mesh_index& index)
+{
+    const auto data = index.data;
+    if (data == nullptr)
+        return;
+
+    std::vector<cgltf_size> accessors;
+    std::vector<cgltf_size> counts;
+    for (cgltf_size i = 0; i < index.accessor_bounds_dirty.size(); ++i) {
+        if (!index.accessor_bounds_dirty[i])
             continue;
+        index.accessor_bounds_dirty[i] = 0;
 
-        for (cgltf_size j = 0; j < mesh->primitives_count; ++j) {
-            const auto primitive = &mesh->primitives[j];
+        const auto accessor = &data->accessors[i];
+        if (!accessor->has_min && !accessor->has_max)
+            continue;
 
-            for (cgltf_size k = 0; k < primitive->attributes_count; ++k) {
-                const auto attr = &primitive->attributes[k];
-                const auto accessor = attr->data;
+        const cgltf_size components = cgltf_num_components(accessor->type);
+        if (accessor->component_type != cgltf_component_type_r_32f || accessor->is_sparse || accessor->buffer_view == nullptr || components > 16) {
+            gltf_update_bounds_accessor(accessor);
+            continue;
+        }
+        accessors.push_back(i);
+        counts.push_back(accessor->count);
+    }
 
-                if (accessor_coord_done.count(accessor) > 0) {
-                    continue;
-                }
-                if (attr->type == cgltf_attribute_type_position) {
-                    gltf_reverse_z_accessor(accessor);
-                } else if (attr->type == cgltf_attribute_type_normal) {
-                    gltf_reverse_z_accessor(accessor);
-                }
-                accessor_coord_done.emplace(accessor);
-            }
+    const auto ranges = gltf_parallel_split(counts);
+    std::vector<cgltf_float> bounds(ranges.size() * 32);
+    for (cgltf_size i = 0; i < ranges.size(); ++i) {
+        std::fill(bounds.begin() + i * 32, bounds.begin() + i * 32 + 16, FLT_MAX);
+        std::fill(bounds.begin() + i * 32 + 16, bounds.begin() + i * 32 + 32, -FLT_MAX);
+    }
 
-            for (cgltf_size k = 0; k < primitive->targets_count; ++k) {
-                const auto target = &primitive->targets[k];
-                for (cgltf_size a = 0; a < target->attributes_count; ++a) {
-                    const auto attr = &target->attributes[a];
-                    const auto accessor = attr->data;
-                    if (accessor_coord_done.count(accessor) > 0) {
-                        continue;
-                    }
-                    if (attr->type == cgltf_attribute_type_position) {
-                        gltf_reverse_z_accessor(accessor);
-                    } else if (attr->type == cgltf_attribute_type_normal) {
-                        gltf_reverse_z_accessor(accessor);
-                    }
-                    accessor_coord_done.emplace(accessor);
-                }
-            }
+    const gltf_bounds_kernel kernel = gltf_select_bounds_kernel();
+    gltf_parallel_for(ranges, [&](cgltf_size range_index, const gltf_parallel_range& range) {
+        const auto accessor = &data->accessors[accessors[range.item]];
+        const auto buffer_data = gltf_buffer_view_data(accessor->buffer_view) + accessor->offset;
+        const auto available = accessor->buffer_view->size > accessor->offset ? accessor->buffer_view->size - accessor->offset : 0;
+        kernel(buffer_data, accessor->stride, cgltf_num_components(accessor->type), range.begin, range.end, available, &bounds[range_index * 32], &bounds[range_index * 32 + 16]);
+    });
+
+    for (const auto i : accessors) {
+        const auto accessor = &data->accessors[i];
+        for (cgltf_size c = 0; c < 16; ++c) {
+            accessor->min[c] = FLT_MAX;
+            accessor->max[c] = -FLT_MAX;
         }
     }
+    for (cgltf_size i = 0; i < ranges.size(); ++i) {
+        const auto accessor = &data->accessors[accessors[ranges[i].item]];
+        const cgltf_size components = cgltf_num_components(accessor->type);
+        gltf_bounds_kernel_scalar((const uint8_t*)&bounds[i * 32], 0, components, 0, 1, 64, accessor->min, accessor->max);
+        gltf_bounds_kernel_scalar((const uint8_t*)&bounds[i * 32 + 16], 0, components, 0, 1, 64, accessor->min, accessor->max);
+    }
+}
+
+static void gltf_reverse_z(cgltf_data* data, gltf_mesh_index& index)
+{
+    for (const auto i : index.coord_accessors) {
+        const auto accessor = &data->accessors[i];
+        gltf_mesh_index_mark_dirty(index, accessor);
+        gltf_accessor_write_data(data, accessor);
+    }
+
+    gltf_parallel_accessors(data, index.coord_accessors, [&](cgltf_size item, cgltf_size begin, cgltf_size end) {
+        gltf_reverse_z_range(&data->accessors[index.coord_accessors[item]], begin, end);
+    });
 
     for (cgltf_size i = 0; i < data->nodes_count; ++i) {
         const auto node = &data->nodes[i];
@@ -404,159 +910,323 @@ static void gltf_reverse_z(cgltf_data* data)
             node->translation[2] = -node->translation[2];
         }
     }
+    gltf_world_mark_all_dirty(index.world);
 }
 
-static uint32_t gltf_get_buffer_size(cgltf_data* data)
+// Removes whitespace outside of strings in place, returns the new length
+static size_t gltf_json_minify(char* json, size_t size)
 {
-    uint32_t size = 0;
-    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
-        cgltf_buffer* buffer = &data->buffers[i];
-        cgltf_size aligned_size = (buffer->size + 3) & ~3;
-
-        size += (uint32_t)aligned_size + 8;
+    size_t length = 0;
+    bool in_string = false;
+    for (size_t i = 0; i < size; ++i) {
+        const char c = json[i];
+        if (in_string) {
+            json[length++] = c;
+            if (c == '\\' && i + 1 < size) {
+                json[length++] = json[++i];
+            } else if (c == '"') {
+                in_string = false;
+            }
+        } else if (c == '"') {
+            in_string = true;
+            json[length++] = c;
+        } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+            json[length++] = c;
+        }
     }
-    return size;
+    return length;
 }
 
-static std::string gltf_get_json(cgltf_options* options, cgltf_data* data)
+// JSON chunk of GLB: minified and padded with spaces to 4 bytes. cgltf_write() output (indented,
+// extras and extensions as they were in the source) is compacted in the same allocation.
+static std::string gltf_get_json(const cgltf_options* options, cgltf_data* data)
 {
-    auto size = cgltf_write(options, NULL, 0, data);
-    auto buffer = (char*)gltf_calloc(size, sizeof(char*));
-    cgltf_write(options, buffer, size, data);
+    // cgltf_write() needs the size up front, it includes null terminator
+    const auto size = cgltf_write(options, nullptr, 0, data);
+    if (size <= 1)
+        return "";
+
+    std::string json(size + 3, ' ');
+    cgltf_write(options, &json[0], size, data);
 
-    // compress JSON
-    auto j = nlohmann::json::parse(buffer, nullptr, false, true);
+    const auto length = gltf_json_minify(&json[0], size - 1);
+    if (length == 0)
+        return "";
 
-    data->memory.free(data->memory.user_data, buffer);
+    const auto aligned_length = (length + 3) & ~3;
+    std::fill(json.begin() + length, json.begin() + aligned_length, ' ');
+    json.resize(aligned_length);
 
-    if (j.is_object()) {
-        auto dump = j.dump();
-        cgltf_size dump_size = dump.size();
-        cgltf_size aligned_size = (dump_size + 3) & ~3;
-        cgltf_size align = aligned_size - dump_size;
-        for (cgltf_size i = 0; i < align; ++i) {
-            dump.append(" ");
+    return json;
+}
+
+// Buffers are ropes of buffer views: a view either borrows its bytes from the buffer (offset into
+// the original data) or owns what it was rewritten to (buffer_view->data). Components only replace
+// views, buffers are compacted (views in order, 4 byte aligned) once when data is written.
+struct gltf_buffer_packing {
+    bool repack; // false: buffers are written as they are
+    std::vector<cgltf_size> view_offsets;
+    std::vector<cgltf_size> buffer_sizes;
+};
+
+static void gltf_buffer_packing_build(const cgltf_data* data, gltf_buffer_packing* packing)
+{
+    packing->repack = false;
+    for (cgltf_size i = 0; i < data->buffer_views_count; ++i) {
+        if (data->buffer_views[i].data != nullptr) {
+            packing->repack = true;
+            break;
         }
-        return dump;
     }
 
-    return "";
+    packing->view_offsets.resize(data->buffer_views_count);
+    packing->buffer_sizes.resize(data->buffers_count);
+    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+        packing->buffer_sizes[i] = packing->repack ? 0 : data->buffers[i].size;
+    }
+    for (cgltf_size j = 0; j < data->buffer_views_count; ++j) {
+        const auto buffer_view = &data->buffer_views[j];
+        packing->view_offsets[j] = buffer_view->offset;
+        if (packing->repack && buffer_view->buffer != nullptr) {
+            const auto i = (cgltf_size)(buffer_view->buffer - data->buffers);
+            packing->view_offsets[j] = packing->buffer_sizes[i];
+            packing->buffer_sizes[i] += (buffer_view->size + 3) & ~3;
+        }
+    }
 }
 
-static bool gltf_write_file(cgltf_options* options, cgltf_data* data, std::string output)
+// Makes JSON of data refer to the packed layout while views keep pointing at their bytes.
+// Call it again to swap back.
+static void gltf_buffer_packing_swap(cgltf_data* data, gltf_buffer_packing* packing)
 {
-    std::ofstream fout(output, std::ios::trunc | std::ios::binary);
-    if (fout.fail()) {
-        return false;
+    for (cgltf_size j = 0; j < data->buffer_views_count; ++j) {
+        std::swap(data->buffer_views[j].offset, packing->view_offsets[j]);
+    }
+    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+        std::swap(data->buffers[i].size, packing->buffer_sizes[i]);
     }
+}
+
+// GLB file as a list of memory ranges: header, JSON chunk and every buffer view straight from
+// where it is (original bin or buffer_view->data), so that nothing is packed before writing
+struct gltf_glb_segment {
+    const void* data;
+    size_t size;
+};
+
+struct gltf_glb_layout {
+    std::string json;
+    std::vector<uint32_t> headers; // GLB header and chunk headers, segments point into it
+    std::vector<gltf_glb_segment> segments;
+    size_t size;
+};
+
+static const uint8_t gltf_glb_padding[4] = { 0, 0, 0, 0 };
+
+static bool gltf_glb_layout_build(const cgltf_options* options, cgltf_data* data, gltf_glb_layout* layout)
+{
+    gltf_buffer_packing packing;
+    gltf_buffer_packing_build(data, &packing);
 
-    const auto in_json = gltf_get_json(options, data);
-    const auto in_json_cstr = in_json.c_str();
-    const auto in_json_size = (uint32_t)strlen(in_json_cstr);
-    uint32_t total_size = GlbHeaderSize + GlbChunkHeaderSize + in_json_size + gltf_get_buffer_size(data);
+    gltf_buffer_packing_swap(data, &packing);
+    layout->json = gltf_get_json(options, data);
+    gltf_buffer_packing_swap(data, &packing);
 
-    fout.write(reinterpret_cast<const char*>(&GlbMagic), 4);
-    fout.write(reinterpret_cast<const char*>(&GlbVersion), 4);
-    fout.write(reinterpret_cast<const char*>(&total_size), 4);
+    if (layout->json.empty())
+        return false;
 
-    fout.write(reinterpret_cast<const char*>(&in_json_size), 4);
-    fout.write(reinterpret_cast<const char*>(&GlbMagicJsonChunk), 4);
+    const auto& buffer_sizes = packing.buffer_sizes;
 
-    fout.write(in_json_cstr, in_json_size);
+    const auto json_size = (uint32_t)layout->json.size();
+    layout->size = GlbHeaderSize + GlbChunkHeaderSize + json_size;
+    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+        layout->size += GlbChunkHeaderSize + ((buffer_sizes[i] + 3) & ~3);
+    }
 
+    // all headers are in place before segments point into them
+    layout->headers = { GlbMagic, GlbVersion, (uint32_t)layout->size, json_size, GlbMagicJsonChunk };
     for (cgltf_size i = 0; i < data->buffers_count; ++i) {
-        cgltf_buffer* buffer = &data->buffers[i];
-        cgltf_size aligned_size = (buffer->size + 3) & ~3;
-        cgltf_size align = aligned_size - buffer->size;
+        layout->headers.push_back((uint32_t)((buffer_sizes[i] + 3) & ~3));
+        layout->headers.push_back(GlbMagicBinChunk);
+    }
+
+    auto& segments = layout->segments;
+    const auto add_segment = [&segments](const void* ptr, size_t size) {
+        if (size > 0)
+            segments.push_back({ ptr, size });
+    };
+    const auto add_padding = [&add_segment](size_t size) {
+        add_segment(gltf_glb_padding, ((size + 3) & ~3) - size);
+    };
 
-        fout.write(reinterpret_cast<const char*>(&aligned_size), 4);
-        fout.write(reinterpret_cast<const char*>(&GlbMagicBinChunk), 4);
-        fout.write(reinterpret_cast<const char*>(buffer->data), buffer->size);
+    add_segment(&layout->headers[0], GlbHeaderSize);
+    add_segment(&layout->headers[3], GlbChunkHeaderSize);
+    add_segment(layout->json.data(), json_size);
 
-        const std::int8_t zero = 0;
-        for (uint32_t j = 0; j < align; ++j) {
-            fout.write(reinterpret_cast<const char*>(&zero), 1);
+    for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+        const auto buffer = &data->buffers[i];
+        add_segment(&layout->headers[5 + i * 2], GlbChunkHeaderSize);
+
+        if (packing.repack) {
+            for (cgltf_size j = 0; j < data->buffer_views_count; ++j) {
+                const auto buffer_view = &data->buffer_views[j];
+                if (buffer_view->buffer == buffer) {
+                    add_segment(gltf_buffer_view_data(buffer_view), buffer_view->size);
+                    add_padding(buffer_view->size);
+                }
+            }
+        } else {
+            add_segment(buffer->data, buffer->size);
+            add_padding(buffer->size);
         }
     }
 
-    fout.close();
-
     return true;
 }
 
-static bool gltf_write_json(cgltf_options* options, cgltf_data* data, std::string output)
+static bool gltf_glb_write_segments(const std::string& output, const gltf_glb_layout& layout)
 {
-    return cgltf_write_file(options, output.c_str(), data) == cgltf_result_success;
+#ifndef WIN32
+    const int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    std::vector<iovec> iov(layout.segments.size());
+    for (size_t i = 0; i < iov.size(); ++i) {
+        iov[i].iov_base = const_cast<void*>(layout.segments[i].data);
+        iov[i].iov_len = layout.segments[i].size;
+    }
+
+    // writev() takes up to IOV_MAX (1024 on Linux and macOS) ranges and may write part of them
+    const size_t iov_max = 1024;
+    bool success = true;
+    size_t index = 0;
+    while (index < iov.size()) {
+        const auto written = ::writev(fd, &iov[index], (int)std::min(iov.size() - index, iov_max));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            success = false;
+            break;
+        }
+
+        auto remaining = (size_t)written;
+        while (index < iov.size() && remaining >= iov[index].iov_len) {
+            remaining -= iov[index].iov_len;
+            ++index;
+        }
+        if (remaining > 0) {
+            iov[index].iov_base = (uint8_t*)iov[index].iov_base + remaining;
+            iov[index].iov_len -= remaining;
+        }
+    }
+
+    if (::close(fd) != 0)
+        success = false;
+
+    return success;
+#else
+    std::ofstream fout(output, std::ios::trunc | std::ios::binary);
+    if (fout.fail())
+        return false;
+
+    for (const auto& segment : layout.segments) {
+        fout.write(reinterpret_cast<const char*>(segment.data), segment.size);
+    }
+    fout.close();
+
+    return !fout.fail();
+#endif
 }
 
-static glm::mat4 gltf_get_node_transform(const cgltf_node* node)
+// Writes GLB to output, into memory files instead of disk when memory is given
+static bool gltf_write_file(const cgltf_options* options, cgltf_data* data, std::string output, AvatarBuild::memory_files* memory = nullptr)
 {
-    auto matrix = glm::mat4(1.0f);
-    auto translation = glm::make_vec3(node->translation);
-    auto scale = glm::make_vec3(node->scale);
-    auto rotation = glm::make_quat(node->rotation);
+    AvatarBuild::trace_scope trace("write", "file");
+    trace.arg_data(data);
 
-    return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
+    gltf_glb_layout layout;
+    if (!gltf_glb_layout_build(options, data, &layout))
+        return false;
+
+    if (memory != nullptr) {
+        std::vector<uint8_t> glb;
+        glb.reserve(layout.size);
+        for (const auto& segment : layout.segments) {
+            const auto bytes = (const uint8_t*)segment.data;
+            glb.insert(glb.end(), bytes, bytes + segment.size);
+        }
+        memory->put(output, std::move(glb));
+        trace.arg("output", output);
+        trace.arg("output_bytes", (uint64_t)layout.size);
+        return true;
+    }
+
+    if (!gltf_glb_write_segments(output, layout))
+        return false;
+
+    trace.arg_file("output", output);
+
+    return true;
 }
 
-static glm::mat4 gltf_get_global_node_transform(const cgltf_node* node)
+// cgltf_parse_file(), from memory files instead of disk when memory is given. Data gets its own arena,
+// release it with gltf_free_data(). Data parsed from memory points into the file, it has to outlive the data.
+static cgltf_result gltf_parse_file(const cgltf_options* options, std::string input, AvatarBuild::memory_files* memory, cgltf_data** out_data)
 {
-    auto m = gltf_get_node_transform(node);
-    cgltf_node* parent = node->parent;
-    GLTF_PARENT_LOOP_BEGIN (parent != nullptr)
-        m = gltf_get_node_transform(parent) * m;
-        parent = parent->parent;
-    GLTF_PARENT_LOOP_END
+    AvatarBuild::memory_files::bytes file;
+    if (memory != nullptr) {
+        file = memory->get(input);
+        if (!file)
+            return cgltf_result_file_not_found;
+    }
 
-    return m;
+    cgltf_options parse_options;
+    const auto arena = gltf_arena_options(options, &parse_options);
+
+    const auto result = file ? cgltf_parse(&parse_options, file->data(), file->size(), out_data) : cgltf_parse_file(&parse_options, input.c_str(), out_data);
+    if (result != cgltf_result_success)
+        gltf_arena_release(arena);
+
+    return result;
 }
 
-static void gltf_apply_transform_meshes(cgltf_data* data)
+static bool gltf_write_json(const cgltf_options* options, cgltf_data* data, std::string output)
 {
-    std::set<cgltf_accessor*> accessor_coord_done;
-    for (cgltf_size i = 0; i < data->nodes_count; ++i) {
-        const auto node = &data->nodes[i];
-        const auto mesh = node->mesh;
+    gltf_buffer_packing packing;
+    gltf_buffer_packing_build(data, &packing);
 
-        if (mesh == nullptr)
-            continue;
+    gltf_buffer_packing_swap(data, &packing);
+    const auto result = cgltf_write_file(options, output.c_str(), data);
+    gltf_buffer_packing_swap(data, &packing);
+
+    return result == cgltf_result_success;
+}
 
-        for (cgltf_size j = 0; j < mesh->primitives_count; ++j) {
-            const auto primitive = &mesh->primitives[j];
+// cgltf_validate() against the layout data is written with, views may have outgrown their place in buffer
+static cgltf_result gltf_validate(cgltf_data* data)
+{
+    gltf_buffer_packing packing;
+    gltf_buffer_packing_build(data, &packing);
 
-            for (cgltf_size k = 0; k < primitive->attributes_count; ++k) {
-                const auto attr = &primitive->attributes[k];
-                const auto accessor = attr->data;
+    gltf_buffer_packing_swap(data, &packing);
+    const auto result = cgltf_validate(data);
+    gltf_buffer_packing_swap(data, &packing);
 
-                if (accessor_coord_done.count(accessor) > 0) {
-                    continue;
-                }
-                if (attr->type == cgltf_attribute_type_position) {
-                    gltf_apply_transform_accessor(node, accessor);
-                } else if (attr->type == cgltf_attribute_type_normal) {
-                    gltf_apply_transform_accessor(node, accessor);
-                }
-                accessor_coord_done.emplace(accessor);
-            }
+    return result;
+}
 
-            for (cgltf_size k = 0; k < primitive->targets_count; ++k) {
-                const auto target = &primitive->targets[k];
-                for (cgltf_size a = 0; a < target->attributes_count; ++a) {
-                    const auto attr = &target->attributes[a];
-                    const auto accessor = attr->data;
-                    if (accessor_coord_done.count(accessor) > 0) {
-                        continue;
-                    }
-                    if (attr->type == cgltf_attribute_type_position) {
-                        gltf_apply_transform_accessor(node, accessor);
-                    } else if (attr->type == cgltf_attribute_type_normal) {
-                        gltf_apply_transform_accessor(node, accessor);
-                    }
-                    accessor_coord_done.emplace(accessor);
-                }
-            }
-        }
+static void gltf_apply_transform_meshes(cgltf_data* data, gltf_mesh_index& index)
+{
+    for (const auto i : index.coord_accessors) {
+        const auto accessor = &data->accessors[i];
+        gltf_mesh_index_mark_dirty(index, accessor);
+        gltf_accessor_write_data(data, accessor);
     }
+
+    gltf_parallel_accessors(data, index.coord_accessors, [&](cgltf_size item, cgltf_size begin, cgltf_size end) {
+        gltf_apply_transform_range(&data->nodes[index.coord_nodes[item]], &data->accessors[index.coord_accessors[item]], begin, end);
+    });
 }
 
 static void gltf_apply_transform(cgltf_node* node, const glm::mat4 parent_matrix)
@@ -616,145 +1286,9 @@ static inline void gltf_from_mat4_to_floats(const glm::mat4& from, cgltf_float*
     to[15] = from[3][3];
 }
 
-static bool gltf_apply_weight(cgltf_node* skin_node, cgltf_float* positions, cgltf_uint* joints, cgltf_float* weights, cgltf_float* normals)
-{
-    glm::mat4 skinMat = glm::mat4(0.f);
-
-    const cgltf_skin* skin = skin_node->skin;
-
-    const cgltf_accessor* accessor = skin_node->skin->inverse_bind_matrices;
-    uint8_t* ibm_data = (uint8_t*)accessor->buffer_view->buffer->data + accessor->buffer_view->offset + accessor->offset;
-
-    glm::mat4 globalTransform = gltf_get_global_node_transform(skin_node);
-    glm::mat4 globalInverseTransform = glm::inverse(globalTransform);
-
-    for (cgltf_size i = 0; i < 4; ++i) {
-        const cgltf_uint joint_index = joints[i];
-        cgltf_float weight = weights[i];
-
-        if (weight <= 0)
-            continue;
-
-        if (skin->joints_count <= joint_index)
-            continue;
-
-        const cgltf_float* ibm_mat = (cgltf_float*)(ibm_data + accessor->stride * joint_index);
-
-        const auto joint = skin->joints[joint_index];
-
-        glm::mat4 globalTransformOfJointNode = gltf_get_global_node_transform(joint);
-        glm::mat4 inverseBindMatrixForJoint = glm::make_mat4(ibm_mat);
-        glm::mat4 jointMatrix = globalTransformOfJointNode * inverseBindMatrixForJoint;
-        jointMatrix = globalInverseTransform * jointMatrix;
-
-        skinMat += jointMatrix * weight;
-    }
-
-    glm::vec4 inPos = glm::vec4(positions[0], positions[1], positions[2], 1.f);
-    glm::vec4 locPos = globalTransform * skinMat * inPos;
-
-    positions[0] = locPos.x;
-    positions[1] = locPos.y;
-    positions[2] = locPos.z;
-
-    if (normals != nullptr) {
-        glm::vec3 inNormal = glm::make_vec3(normals);
-        glm::vec3 outNormal = glm::normalize(glm::transpose(glm::inverse(glm::mat3(globalTransform * skinMat))) * inNormal);
-
-        normals[0] = outNormal.x;
-        normals[1] = outNormal.y;
-        normals[2] = outNormal.z;
-    }
-
-    skin_node->scale[0] = 1;
-    skin_node->scale[1] = 1;
-    skin_node->scale[2] = 1;
-
-    skin_node->rotation[0] = 0;
-    skin_node->rotation[1] = 0;
-    skin_node->rotation[2] = 0;
-    skin_node->rotation[3] = 1;
-
-    return true;
-}
-
-static bool gltf_apply_weights(cgltf_node* skin_node, cgltf_accessor* positions, cgltf_accessor* joints, cgltf_accessor* weights, cgltf_accessor* normals)
-{
-    cgltf_uint* joints_data = (cgltf_uint*)gltf_calloc(joints->count * 4, sizeof(cgltf_uint));
-    for (cgltf_size i = 0; i < joints->count; ++i) {
-        cgltf_accessor_read_uint(joints, i, joints_data + (i * 4), 4);
-    }
-
-    cgltf_size unpack_count = weights->count * 4;
-    cgltf_float* weights_data = (cgltf_float*)gltf_calloc(unpack_count, sizeof(cgltf_float));
-    cgltf_accessor_unpack_floats(weights, weights_data, unpack_count);
-
-    uint8_t* positions_data = (uint8_t*)positions->buffer_view->buffer->data + positions->buffer_view->offset + positions->offset;
-    uint8_t* normals_data = nullptr;
-
-    if (normals != nullptr) {
-        normals_data = (uint8_t*)normals->buffer_view->buffer->data + normals->buffer_view->offset + normals->offset;
-    }
-
-    positions->max[0] = -FLT_MAX;
-    positions->max[1] = -FLT_MAX;
-    positions->max[2] = -FLT_MAX;
-    positions->min[0] = FLT_MAX;
-    positions->min[1] = FLT_MAX;
-    positions->min[2] = FLT_MAX;
-
-    for (cgltf_size i = 0; i < positions->count; ++i) {
-        cgltf_float* position = (cgltf_float*)(positions_data + (positions->stride * i));
-        cgltf_float* normal = normals_data != nullptr ? (cgltf_float*)(normals_data + (normals->stride * i)) : nullptr;
-
-        gltf_apply_weight(skin_node, position, joints_data + (i * 4), weights_data + (i * 4), normal);
-
-        gltf_f3_max(position, positions->max, positions->max);
-        gltf_f3_min(position, positions->min, positions->min);
-    }
-
-    gltf_free(joints_data);
-    gltf_free(weights_data);
-
-    return true;
-}
-
-static bool gltf_skinning(cgltf_data* data)
-{
-    for (cgltf_size i = 0; i < data->nodes_count; ++i) {
-        const auto node = &data->nodes[i];
-        const auto mesh = node->mesh;
-        if (mesh == nullptr)
-            continue;
-        for (cgltf_size j = 0; j < mesh->primitives_count; ++j) {
-            const auto primitive = &mesh->primitives[j];
-            cgltf_accessor* acc_POSITION = nullptr;
-            cgltf_accessor* acc_JOINTS = nullptr;
-            cgltf_accessor* acc_WEIGHTS = nullptr;
-            cgltf_accessor* acc_NORMAL = nullptr;
-            for (cgltf_size k = 0; k < primitive->attributes_count; ++k) {
-                const auto attr = &primitive->attributes[k];
-                if (attr->type == cgltf_attribute_type_position) {
-                    acc_POSITION = attr->data;
-                } else if (attr->type == cgltf_attribute_type_normal) {
-                    acc_NORMAL = attr->data;
-                } else if (attr->type == cgltf_attribute_type_joints) {
-                    acc_JOINTS = attr->data;
-                } else if (attr->type == cgltf_attribute_type_weights) {
-                    acc_WEIGHTS = attr->data;
-                }
-            }
-            if (acc_POSITION && acc_JOINTS && acc_WEIGHTS) {
-                gltf_apply_weights(node, acc_POSITION, acc_JOINTS, acc_WEIGHTS, acc_NORMAL);
-            }
-        }
-    }
-    return true;
-}
-
-static void gltf_apply_transforms(cgltf_data* data, std::unordered_map<std::string, cgltf_node*>& name_to_node)
+static void gltf_apply_transforms(cgltf_data* data, std::unordered_map<std::string, cgltf_node*>& name_to_node, gltf_mesh_index& index)
 {
-    gltf_apply_transform_meshes(data);
+    gltf_apply_transform_meshes(data, index);
 
     for (cgltf_size i = 0; i < data->scenes_count; ++i) {
         const auto scene = &data->scenes[i];
@@ -784,39 +1318,26 @@ static void gltf_apply_transforms(cgltf_data* data, std::unordered_map<std::stri
         bone_hips->translation[1] += offset_translation.y;
         bone_hips->translation[2] += offset_translation.z;
     }
+
+    gltf_world_mark_all_dirty(index.world);
 }
 
-static void gltf_update_inverse_bind_matrices(cgltf_data* data)
+static void gltf_update_inverse_bind_matrices(cgltf_data* data, gltf_mesh_index& index)
 {
-    std::set<cgltf_accessor*> skin_done;
-    for (cgltf_size i = 0; i < data->skins_count; ++i) {
-        const auto skin = &data->skins[i];
-        const auto accessor = skin->inverse_bind_matrices;
+    for (cgltf_size i = 0; i < index.skin_accessors.size(); ++i) {
+        const auto skin = &data->skins[index.skin_indices[i]];
+        const auto accessor = &data->accessors[index.skin_accessors[i]];
+        gltf_mesh_index_mark_dirty(index, accessor);
 
-        if (skin_done.count(accessor) > 0) {
-            continue;
-        }
-        skin_done.emplace(accessor);
-
-        uint8_t* buffer_data = (uint8_t*)accessor->buffer_view->buffer->data + accessor->buffer_view->offset + accessor->offset;
-
-        accessor->max[0] = -FLT_MAX;
-        accessor->max[1] = -FLT_MAX;
-        accessor->max[2] = -FLT_MAX;
-        accessor->min[0] = FLT_MAX;
-        accessor->min[1] = FLT_MAX;
-        accessor->min[2] = FLT_MAX;
+        uint8_t* buffer_data = gltf_accessor_write_data(data, accessor);
 
         for (cgltf_size j = 0; j < skin->joints_count; ++j) {
             cgltf_node* node = skin->joints[j];
             cgltf_float* inverse_bind_matrix = (cgltf_float*)(buffer_data + accessor->stride * j);
 
-            glm::mat4 inversed = glm::inverse(gltf_get_global_node_transform(node));
+            glm::mat4 inversed = glm::inverse(gltf_get_world_transform(index.world, node, data));
 
             gltf_from_mat4_to_floats(inversed, inverse_bind_matrix);
-
-            gltf_f3_max(inverse_bind_matrix + 12, accessor->max, accessor->max);
-            gltf_f3_min(inverse_bind_matrix + 12, accessor->min, accessor->min);
         }
     }
 }
@@ -865,7 +1386,7 @@ static bool gltf_images_jpg_to_png(cgltf_data* data)
         if (!gltf_is_mimetype_jpeg(image->mime_type))
             continue;
 
-        const auto buffer = ((uint8_t*)image->buffer_view->buffer->data + image->buffer_view->offset);
+        const auto buffer = gltf_buffer_view_data(image->buffer_view);
         int x, y, n;
         const auto image_data = stbi_load_from_memory(buffer, (int)image->buffer_view->size, &x, &y, &n, 0);
         if (image_data == nullptr) {
@@ -875,11 +1396,9 @@ static bool gltf_images_jpg_to_png(cgltf_data* data)
         stbi_image_free(image_data); // safe to free here because buffer has been already copied to image buffer
 
         // assign new mime type
-        gltf_free(image->mime_type);
-        image->mime_type = gltf_alloc_chars("image/png");
+        gltf_data_free(data, image->mime_type);
+        image->mime_type = gltf_data_alloc_chars(data, "image/png");
     }
 
-    gltf_create_buffer(data);
-
     return true;
 }
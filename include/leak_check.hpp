@@ -0,0 +1,242 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_ReturnAddress)
+#define AVATAR_RETURN_ADDRESS() _ReturnAddress()
+#else
+#include <dlfcn.h>
+#define AVATAR_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+namespace AvatarBuild {
+
+// Tracks live allocations in open-addressing hash tables, sharded by pointer so that
+// threads rarely wait on each other. Metadata is kept out of band: blocks are plain
+// calloc'ed memory and tracking costs one probe sequence per allocation and free.
+class leak_checker {
+public:
+    // where the block was allocated: file/line for gltf_calloc, return address for cgltf hooks
+    struct call_site {
+        const char* file;
+        int line;
+        void* caller;
+    };
+
+    void* allocate(size_t size, call_site site)
+    {
+        void* ptr = calloc(1, size);
+        if (ptr == nullptr)
+            return nullptr;
+
+        auto& shard = shard_of(ptr);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.insert({ ptr, size, site });
+        return ptr;
+    }
+
+    void release(void* ptr)
+    {
+        if (ptr == nullptr)
+            return;
+
+        bool found;
+        {
+            auto& shard = shard_of(ptr);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            found = shard.erase(ptr);
+        }
+
+        if (found) {
+            free(ptr);
+        } else {
+            // double free, or memory not allocated by us: leave it alone and report at dump
+            std::lock_guard<std::mutex> lock(invalid_mutex);
+            ++invalid_frees;
+        }
+    }
+
+    // Prints live allocations grouped by call site, largest first. true when anything leaked.
+    bool dump()
+    {
+        std::map<std::tuple<const char*, int, void*>, std::pair<size_t, size_t>> sites; // count, bytes
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (const auto& entry : shard.entries) {
+                if (entry.ptr == nullptr)
+                    continue;
+                auto& site = sites[std::make_tuple(entry.site.file, entry.site.line, entry.site.caller)];
+                site.first++;
+                site.second += entry.size;
+            }
+        }
+
+        std::vector<std::pair<std::tuple<const char*, int, void*>, std::pair<size_t, size_t>>> sorted(sites.begin(), sites.end());
+        std::sort(sorted.begin(), sorted.end(), [](const decltype(sorted)::value_type& a, const decltype(sorted)::value_type& b) {
+            return a.second.second > b.second.second;
+        });
+
+        size_t total_count = 0, total_bytes = 0;
+        for (const auto& item : sorted) {
+            const auto& key = item.first;
+            printf("LEAKED: %s: %zu blocks, %zu bytes\n", describe(std::get<0>(key), std::get<1>(key), std::get<2>(key)).c_str(), item.second.first, item.second.second);
+            total_count += item.second.first;
+            total_bytes += item.second.second;
+        }
+        if (total_count > 0) {
+            printf("LEAKED: total %zu blocks, %zu bytes from %zu call sites\n", total_count, total_bytes, sorted.size());
+        }
+
+        std::lock_guard<std::mutex> lock(invalid_mutex);
+        if (invalid_frees > 0) {
+            printf("INVALID FREE: %zu pointers were not allocated or already freed\n", invalid_frees);
+        }
+
+        return total_count > 0 || invalid_frees > 0;
+    }
+
+private:
+    struct entry {
+        void* ptr; // nullptr: empty slot
+        size_t size;
+        call_site site;
+    };
+
+    // linear probing with backward shift deletion, no tombstones
+    struct shard {
+        std::mutex mutex;
+        std::vector<entry> entries;
+        size_t count = 0;
+
+        static size_t hash(void* ptr)
+        {
+            uint64_t h = (uint64_t)(uintptr_t)ptr;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return (size_t)h;
+        }
+
+        void insert(const entry& item)
+        {
+            // keep load factor under 1/2
+            if ((count + 1) * 2 > entries.size())
+                grow();
+
+            const size_t mask = entries.size() - 1;
+            size_t i = hash(item.ptr) & mask;
+            while (entries[i].ptr != nullptr)
+                i = (i + 1) & mask;
+            entries[i] = item;
+            ++count;
+        }
+
+        bool erase(void* ptr)
+        {
+            if (entries.empty())
+                return false;
+
+            const size_t mask = entries.size() - 1;
+            size_t i = hash(ptr) & mask;
+            while (entries[i].ptr != ptr) {
+                if (entries[i].ptr == nullptr)
+                    return false;
+                i = (i + 1) & mask;
+            }
+
+            // shift following entries back so that their probe sequences stay unbroken
+            for (size_t j = (i + 1) & mask; entries[j].ptr != nullptr; j = (j + 1) & mask) {
+                const size_t home = hash(entries[j].ptr) & mask;
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                    entries[i] = entries[j];
+                    i = j;
+                }
+            }
+            entries[i] = {};
+            --count;
+            return true;
+        }
+
+        void grow()
+        {
+            std::vector<entry> old;
+            old.swap(entries);
+            entries.resize(old.empty() ? 1024 : old.size() * 2);
+            count = 0;
+            for (const auto& item : old) {
+                if (item.ptr != nullptr)
+                    insert(item);
+            }
+        }
+    };
+
+    static const size_t shards_count = 64;
+
+    shard& shard_of(void* ptr)
+    {
+        // low bits of heap pointers are alignment
+        return shards[((uintptr_t)ptr >> 4) % shards_count];
+    }
+
+    static std::string describe(const char* file, int line, void* caller)
+    {
+        char buffer[512];
+        if (file != nullptr) {
+            snprintf(buffer, sizeof(buffer), "%s (%d)", file, line);
+            return buffer;
+        }
+#ifndef _MSC_VER
+        Dl_info info;
+        if (dladdr(caller, &info) != 0 && info.dli_fname != nullptr) {
+            if (info.dli_sname != nullptr) {
+                snprintf(buffer, sizeof(buffer), "%s+0x%zx", info.dli_sname, (size_t)((uint8_t*)caller - (uint8_t*)info.dli_saddr));
+            } else {
+                snprintf(buffer, sizeof(buffer), "%s+0x%zx", info.dli_fname, (size_t)((uint8_t*)caller - (uint8_t*)info.dli_fbase));
+            }
+            return buffer;
+        }
+#endif
+        snprintf(buffer, sizeof(buffer), "cgltf at %p", caller);
+        return buffer;
+    }
+
+    shard shards[shards_count];
+    std::mutex invalid_mutex;
+    size_t invalid_frees = 0;
+};
+
+} // namespace AvatarBuild
+
+static AvatarBuild::leak_checker pipeline_leak_checker;
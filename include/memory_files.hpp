@@ -0,0 +1,101 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace AvatarBuild {
+
+// Files of a job kept in memory instead of on disk (see avatarbuild.h). Paths are only names here,
+// pipelines read and write them just like files. Thread safe, branches of a job run in parallel.
+class memory_files {
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> bytes;
+
+    void put(const std::string& path, std::vector<uint8_t> data)
+    {
+        auto file = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& entry = files[path];
+        if (entry) {
+            // cgltf_data parsed from the old one may still point into it
+            retired.push_back(entry);
+        } else {
+            order.push_back(path);
+        }
+        entry = file;
+    }
+
+    bytes get(const std::string& path) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto found = files.find(path);
+        return found != files.end() ? found->second : nullptr;
+    }
+
+    // names in the order they were first written
+    std::vector<std::string> names() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return order;
+    }
+
+    // For tools that only work with files (gltfpack)
+    bool export_file(const std::string& path, const std::string& disk_path) const
+    {
+        const auto file = get(path);
+        if (!file)
+            return false;
+
+        std::ofstream fout(disk_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        fout.write(reinterpret_cast<const char*>(file->data()), file->size());
+        fout.close();
+        return !fout.fail();
+    }
+
+    bool import_file(const std::string& disk_path, const std::string& path)
+    {
+        std::ifstream fin(disk_path, std::ios::in | std::ios::binary);
+        if (fin.fail())
+            return false;
+
+        put(path, std::vector<uint8_t>(std::istreambuf_iterator<char>(fin), {}));
+        return true;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, bytes> files;
+    std::vector<std::string> order;
+    std::vector<bytes> retired;
+};
+
+} // namespace AvatarBuild
@@ -0,0 +1,270 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_SILENT_WARNINGS
+#include <glm/glm.hpp>
+
+// Semantic roles of an accessor, an accessor can have several roles when it is shared
+enum gltf_accessor_role : uint32_t {
+    gltf_accessor_role_none = 0,
+    gltf_accessor_role_position = 1 << 0,
+    gltf_accessor_role_normal = 1 << 1,
+    gltf_accessor_role_tangent = 1 << 2,
+    gltf_accessor_role_texcoord = 1 << 3,
+    gltf_accessor_role_color = 1 << 4,
+    gltf_accessor_role_joints = 1 << 5,
+    gltf_accessor_role_weights = 1 << 6,
+    gltf_accessor_role_indices = 1 << 7,
+    gltf_accessor_role_morph_target = 1 << 8, // combined with position/normal/tangent
+    gltf_accessor_role_inverse_bind_matrices = 1 << 9,
+};
+
+static const cgltf_size gltf_mesh_index_none = (cgltf_size)-1;
+
+// Skinned primitive, accessors are indices into cgltf_data::accessors (gltf_mesh_index_none if missing)
+struct gltf_skinned_primitive {
+    cgltf_size node;
+    cgltf_size position;
+    cgltf_size normal;
+    cgltf_size tangent;
+    cgltf_size joints;
+    cgltf_size weights;
+};
+
+// World transforms of all nodes indexed by (node - data->nodes), recomputed lazily top-down.
+// A dirty node always has a dirty subtree: a node is only recomputed after its ancestors.
+struct gltf_world_cache {
+    std::vector<glm::mat4> world;
+    std::vector<uint8_t> dirty;
+};
+
+// Node -> mesh -> primitive -> attribute walk done once per loaded asset.
+// All per accessor arrays are indexed by (accessor - data->accessors).
+struct gltf_mesh_index {
+    cgltf_data* data = nullptr;
+
+    std::vector<uint32_t> accessor_roles;       // gltf_accessor_role flags
+    std::vector<uint8_t> accessor_dirty;        // data has been modified since the index was built
+    std::vector<uint8_t> accessor_bounds_dirty; // min/max are stale, see gltf_update_bounds()
+    std::vector<cgltf_size> accessor_target;    // morph target index, gltf_mesh_index_none for base attributes
+    std::vector<cgltf_size> accessor_nodes_offset; // owning nodes of accessor i are accessor_nodes[offset[i], offset[i + 1])
+    std::vector<cgltf_size> accessor_nodes;
+
+    // POSITION and NORMAL accessors (including morph targets) in node order, each accessor once,
+    // with the first node which uses it
+    std::vector<cgltf_size> coord_accessors;
+    std::vector<cgltf_size> coord_nodes;
+
+    // JOINTS_0 accessors, each accessor once
+    std::vector<cgltf_size> joints_accessors;
+
+    // skinned primitives in node order, primitives sharing POSITION are listed once
+    std::vector<gltf_skinned_primitive> skinned_primitives;
+    // nodes which use skinned vertex data listed in skinned_primitives but are not skinned by it,
+    // with the number of skinned_primitives preceding each one in node order
+    std::vector<cgltf_size> skinned_shared_nodes;
+    std::vector<cgltf_size> skinned_shared_order;
+
+    // inverse bind matrices accessors with the first skin which uses it, each accessor once
+    std::vector<cgltf_size> skin_accessors;
+    std::vector<cgltf_size> skin_indices;
+
+    gltf_world_cache world;
+};
+
+static inline cgltf_size gltf_mesh_index_accessor(const gltf_mesh_index& index, const cgltf_accessor* accessor)
+{
+    return accessor != nullptr ? (cgltf_size)(accessor - index.data->accessors) : gltf_mesh_index_none;
+}
+
+static inline cgltf_accessor* gltf_mesh_index_get_accessor(const gltf_mesh_index& index, cgltf_size accessor)
+{
+    return accessor != gltf_mesh_index_none ? &index.data->accessors[accessor] : nullptr;
+}
+
+static inline void gltf_mesh_index_mark_dirty(gltf_mesh_index& index, const cgltf_accessor* accessor)
+{
+    const cgltf_size i = gltf_mesh_index_accessor(index, accessor);
+    if (i != gltf_mesh_index_none) {
+        index.accessor_dirty[i] = 1;
+        index.accessor_bounds_dirty[i] = 1;
+    }
+}
+
+static uint32_t gltf_mesh_index_attribute_role(cgltf_attribute_type type)
+{
+    switch (type) {
+    case cgltf_attribute_type_position:
+        return gltf_accessor_role_position;
+    case cgltf_attribute_type_normal:
+        return gltf_accessor_role_normal;
+    case cgltf_attribute_type_tangent:
+        return gltf_accessor_role_tangent;
+    case cgltf_attribute_type_texcoord:
+        return gltf_accessor_role_texcoord;
+    case cgltf_attribute_type_color:
+        return gltf_accessor_role_color;
+    case cgltf_attribute_type_joints:
+        return gltf_accessor_role_joints;
+    case cgltf_attribute_type_weights:
+        return gltf_accessor_role_weights;
+    default:
+        return gltf_accessor_role_none;
+    }
+}
+
+static void gltf_build_mesh_index(cgltf_data* data, gltf_mesh_index* index)
+{
+    *index = gltf_mesh_index();
+    index->data = data;
+    if (data == nullptr)
+        return;
+
+    const cgltf_size accessors_count = data->accessors_count;
+    index->accessor_roles.assign(accessors_count, gltf_accessor_role_none);
+    index->accessor_dirty.assign(accessors_count, 0);
+    index->accessor_bounds_dirty.assign(accessors_count, 0);
+    index->accessor_target.assign(accessors_count, gltf_mesh_index_none);
+
+    index->world.world.assign(data->nodes_count, glm::mat4(1.f));
+    index->world.dirty.assign(data->nodes_count, 1);
+
+    std::vector<uint8_t> coord_done(accessors_count, 0);
+    std::vector<uint8_t> joints_done(accessors_count, 0);
+    std::vector<uint8_t> skinned_done(accessors_count, 0);
+    std::vector<cgltf_size> node_count(accessors_count, 0);
+    std::vector<std::pair<cgltf_size, cgltf_size>> accessor_node_pairs; // accessor, node
+
+    auto add_coord = [&](cgltf_size accessor, cgltf_size node) {
+        if (coord_done[accessor])
+            return;
+        coord_done[accessor] = 1;
+        index->coord_accessors.push_back(accessor);
+        index->coord_nodes.push_back(node);
+    };
+
+    for (cgltf_size i = 0; i < data->nodes_count; ++i) {
+        const auto node = &data->nodes[i];
+        const auto mesh = node->mesh;
+
+        if (mesh == nullptr)
+            continue;
+
+        for (cgltf_size j = 0; j < mesh->primitives_count; ++j) {
+            const auto primitive = &mesh->primitives[j];
+
+            gltf_skinned_primitive skinned = { i, gltf_mesh_index_none, gltf_mesh_index_none, gltf_mesh_index_none, gltf_mesh_index_none, gltf_mesh_index_none };
+
+            if (primitive->indices != nullptr) {
+                const cgltf_size accessor = gltf_mesh_index_accessor(*index, primitive->indices);
+                index->accessor_roles[accessor] |= gltf_accessor_role_indices;
+                accessor_node_pairs.push_back(std::make_pair(accessor, i));
+            }
+
+            for (cgltf_size k = 0; k < primitive->attributes_count; ++k) {
+                const auto attr = &primitive->attributes[k];
+                if (attr->data == nullptr)
+                    continue;
+
+                const cgltf_size accessor = gltf_mesh_index_accessor(*index, attr->data);
+                index->accessor_roles[accessor] |= gltf_mesh_index_attribute_role(attr->type);
+                accessor_node_pairs.push_back(std::make_pair(accessor, i));
+
+                if (attr->type == cgltf_attribute_type_position) {
+                    skinned.position = accessor;
+                    add_coord(accessor, i);
+                } else if (attr->type == cgltf_attribute_type_normal) {
+                    skinned.normal = accessor;
+                    add_coord(accessor, i);
+                } else if (attr->type == cgltf_attribute_type_tangent) {
+                    skinned.tangent = accessor;
+                } else if (attr->type == cgltf_attribute_type_joints) {
+                    skinned.joints = accessor;
+                    if (attr->name && strcmp(attr->name, "JOINTS_0") == 0 && !joints_done[accessor]) {
+                        joints_done[accessor] = 1;
+                        index->joints_accessors.push_back(accessor);
+                    }
+                } else if (attr->type == cgltf_attribute_type_weights) {
+                    skinned.weights = accessor;
+                }
+            }
+
+            for (cgltf_size k = 0; k < primitive->targets_count; ++k) {
+                const auto target = &primitive->targets[k];
+                for (cgltf_size a = 0; a < target->attributes_count; ++a) {
+                    const auto attr = &target->attributes[a];
+                    if (attr->data == nullptr)
+                        continue;
+
+                    const cgltf_size accessor = gltf_mesh_index_accessor(*index, attr->data);
+                    index->accessor_roles[accessor] |= gltf_mesh_index_attribute_role(attr->type) | gltf_accessor_role_morph_target;
+                    index->accessor_target[accessor] = k;
+                    accessor_node_pairs.push_back(std::make_pair(accessor, i));
+
+                    if (attr->type == cgltf_attribute_type_position || attr->type == cgltf_attribute_type_normal) {
+                        add_coord(accessor, i);
+                    }
+                }
+            }
+
+            if (skinned.position != gltf_mesh_index_none && skinned.joints != gltf_mesh_index_none && skinned.weights != gltf_mesh_index_none) {
+                if (skinned_done[skinned.position]) {
+                    index->skinned_shared_nodes.push_back(i);
+                    index->skinned_shared_order.push_back(index->skinned_primitives.size());
+                } else {
+                    skinned_done[skinned.position] = 1;
+                    index->skinned_primitives.push_back(skinned);
+                }
+            }
+        }
+    }
+
+    for (cgltf_size i = 0; i < data->skins_count; ++i) {
+        const auto skin = &data->skins[i];
+        if (skin->inverse_bind_matrices == nullptr)
+            continue;
+
+        const cgltf_size accessor = gltf_mesh_index_accessor(*index, skin->inverse_bind_matrices);
+        if ((index->accessor_roles[accessor] & gltf_accessor_role_inverse_bind_matrices) == 0) {
+            index->skin_accessors.push_back(accessor);
+            index->skin_indices.push_back(i);
+        }
+        index->accessor_roles[accessor] |= gltf_accessor_role_inverse_bind_matrices;
+    }
+
+    // owning nodes as flat arrays, sorted by accessor without duplicates
+    std::sort(accessor_node_pairs.begin(), accessor_node_pairs.end());
+    accessor_node_pairs.erase(std::unique(accessor_node_pairs.begin(), accessor_node_pairs.end()), accessor_node_pairs.end());
+    for (const auto& pair : accessor_node_pairs) {
+        ++node_count[pair.first];
+    }
+    index->accessor_nodes_offset.assign(accessors_count + 1, 0);
+    for (cgltf_size i = 0; i < accessors_count; ++i) {
+        index->accessor_nodes_offset[i + 1] = index->accessor_nodes_offset[i] + node_count[i];
+    }
+    index->accessor_nodes.reserve(accessor_node_pairs.size());
+    for (const auto& pair : accessor_node_pairs) {
+        index->accessor_nodes.push_back(pair.second);
+    }
+}
@@ -0,0 +1,230 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Fixed size thread pool for the geometry passes. Work is split into ranges up front and the
+// calling thread runs ranges as well, so a pool of N threads has N - 1 workers.
+// Several threads (batch or server jobs) may call run() at the same time, each call is queued
+// as its own job and idle workers help with the oldest one.
+class gltf_thread_pool {
+public:
+    explicit gltf_thread_pool(cgltf_size threads_count)
+    {
+        for (cgltf_size i = 1; i < threads_count; ++i) {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~gltf_thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    cgltf_size size() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Calls fn(range) for every range in [0, ranges_count) and returns when all of them are done.
+    // Workers never wait for other jobs: a run() nested in fn on a worker runs its ranges inline.
+    void run(cgltf_size ranges_count, const std::function<void(cgltf_size)>& fn)
+    {
+        if (ranges_count == 0)
+            return;
+
+        if (workers.empty() || ranges_count == 1 || is_worker()) {
+            for (cgltf_size i = 0; i < ranges_count; ++i) {
+                fn(i);
+            }
+            return;
+        }
+
+        job_state job(fn, ranges_count);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(&job);
+        }
+        wake.notify_all();
+
+        run_ranges(job);
+
+        // workers may still be leaving run_ranges() after the last range is done
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return job.done == job.count && job.active == 0; });
+        remove(&job);
+    }
+
+private:
+    struct job_state {
+        job_state(const std::function<void(cgltf_size)>& fn, cgltf_size count)
+            : fn(fn)
+            , count(count)
+        {
+        }
+
+        const std::function<void(cgltf_size)>& fn;
+        const cgltf_size count;
+        cgltf_size active = 0; // workers in run_ranges(), guarded by mutex
+        std::atomic<cgltf_size> next { 0 };
+        std::atomic<cgltf_size> done { 0 };
+    };
+
+    static bool& is_worker()
+    {
+        static thread_local bool worker = false;
+        return worker;
+    }
+
+    void run_ranges(job_state& job)
+    {
+        for (;;) {
+            const cgltf_size index = job.next.fetch_add(1);
+            if (index >= job.count)
+                break;
+
+            job.fn(index);
+
+            if (job.done.fetch_add(1) + 1 == job.count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+
+    // called with mutex held
+    void remove(job_state* job)
+    {
+        const auto it = std::find(queue.begin(), queue.end(), job);
+        if (it != queue.end())
+            queue.erase(it);
+    }
+
+    void worker_loop()
+    {
+        is_worker() = true;
+        for (;;) {
+            job_state* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (stopping)
+                    return;
+                job = queue.front();
+                ++job->active;
+            }
+            run_ranges(*job);
+            {
+                // every range is taken, the job's own thread finishes it
+                std::lock_guard<std::mutex> lock(mutex);
+                --job->active;
+                remove(job);
+            }
+            done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+    std::deque<job_state*> queue;
+};
+
+static cgltf_size gltf_get_threads_count()
+{
+    if (pipeline_threads_count > 0)
+        return pipeline_threads_count;
+    const cgltf_size hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+static std::mutex& gltf_thread_pool_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+// --threads, may be changed while jobs are running (avatar_build_set_threads)
+static void gltf_set_threads_count(cgltf_size threads_count)
+{
+    std::lock_guard<std::mutex> lock(gltf_thread_pool_mutex());
+    pipeline_threads_count = threads_count;
+}
+
+// Pool sized by pipeline_threads_count. When the count changes a new pool is created,
+// callers still running on the old one keep it alive until they are done.
+static std::shared_ptr<gltf_thread_pool> gltf_get_thread_pool()
+{
+    static std::shared_ptr<gltf_thread_pool> pool;
+
+    std::lock_guard<std::mutex> lock(gltf_thread_pool_mutex());
+    const cgltf_size threads_count = gltf_get_threads_count();
+    if (!pool || pool->size() != threads_count)
+        pool = std::make_shared<gltf_thread_pool>(threads_count);
+    return pool;
+}
+
+// Contiguous part of a work item, vertices [begin, end) of item
+struct gltf_parallel_range {
+    cgltf_size item;
+    cgltf_size begin;
+    cgltf_size end;
+};
+
+// Minimum number of vertices in a range, smaller accessors are processed as a whole
+static const cgltf_size gltf_parallel_grain = 16384;
+
+// Splits items (given as element counts) into ranges of at most gltf_parallel_grain elements.
+// Ranges are ordered by item then by begin, so results stored per range can be merged deterministically.
+static std::vector<gltf_parallel_range> gltf_parallel_split(const std::vector<cgltf_size>& counts)
+{
+    std::vector<gltf_parallel_range> ranges;
+    for (cgltf_size i = 0; i < counts.size(); ++i) {
+        for (cgltf_size begin = 0; begin < counts[i]; begin += gltf_parallel_grain) {
+            ranges.push_back({ i, begin, std::min(begin + gltf_parallel_grain, counts[i]) });
+        }
+    }
+    return ranges;
+}
+
+// Runs fn(range index, range) for all ranges on the thread pool
+static void gltf_parallel_for(const std::vector<gltf_parallel_range>& ranges, const std::function<void(cgltf_size, const gltf_parallel_range&)>& fn)
+{
+    gltf_get_thread_pool()->run(ranges.size(), [&](cgltf_size index) { fn(index, ranges[index]); });
+}
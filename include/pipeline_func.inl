@@ -0,0 +1,439 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+static std::shared_ptr<DSPatch::Component> create_component(std::string name, job_context* context)
+{
+    if (name == "glb_z_reverse") {
+        return std::make_shared<DSPatch::glb_z_reverse>(context);
+    } else if (name == "glb_transforms_apply") {
+        return std::make_shared<DSPatch::glb_transforms_apply>(context);
+    } else if (name == "glb_jpeg_to_png") {
+        return std::make_shared<DSPatch::glb_jpeg_to_png>(context);
+    } else if (name == "glb_fix_roll") {
+        return std::make_shared<DSPatch::glb_fix_roll>(context);
+    } else if (name == "glb_T_pose") {
+        return std::make_shared<DSPatch::glb_T_pose>(context);
+    } else if (name == "glb_overrides") {
+        return std::make_shared<DSPatch::glb_overrides>(context);
+    } else if (name == "vrm0_fix_joint_buffer") {
+        return std::make_shared<DSPatch::vrm0_fix_joint_buffer>(context);
+    } else if (name == "vrm0_default_extensions") {
+        return std::make_shared<DSPatch::vrm0_default_extensions>(context);
+    } else if (name == "vrm0_remove_extensions") {
+        return std::make_shared<DSPatch::vrm0_remove_extensions>(context);
+    } else if (name == "fbx2gltf_execute") {
+        return std::make_shared<DSPatch::fbx2gltf_execute>(context);
+    } else if (name == "gltfpack_execute") {
+        return std::make_shared<DSPatch::gltfpack_execute>(context);
+    }
+    return std::make_shared<DSPatch::noop>(context, name);
+}
+
+static std::shared_ptr<pipeline_processor> create_pipeline(std::string name, job_context* context)
+{
+    if (name == "gltf_pipeline") {
+        return std::make_shared<AvatarBuild::gltf_pipeline>(name, context);
+    } else if (name == "fbx_pipeline") {
+        return std::make_shared<AvatarBuild::fbx_pipeline>(name, context);
+    } else if (name == "gltfpack_pipeline") {
+        return std::make_shared<AvatarBuild::gltfpack_pipeline>(name, context);
+    }
+    return std::make_shared<AvatarBuild::pipeline_processor>(name, context);
+}
+
+static std::shared_ptr<pipeline_processor> wire_pipeline(pipeline* p, job_context* context)
+{
+    const auto pipeline = create_pipeline(p->name, context);
+
+    for (size_t i = 0; i < p->components.size(); ++i) {
+        pipeline->add_component(create_component(p->components[i], context));
+    }
+
+    pipeline->wire_components();
+
+    return pipeline;
+}
+
+// Reads pipeline definitions into graph nodes. "pipelines" array is a linear chain, each pipeline
+// takes the result of previous one. "nodes" and "edges" declare a tree instead, so that one result
+// can fan out to several branches: { "nodes":[{ "id":"pose", ... }], "edges":[{ "from":"pose", "to":"vrm" }] }
+static bool parse_pipeline_graph(json config_json, std::vector<pipeline>* nodes)
+{
+    const auto& pipelines_obj = config_json["pipelines"];
+    const auto& nodes_obj = config_json["nodes"];
+
+    if (!pipelines_obj.is_array() && !nodes_obj.is_array()) {
+        std::cout << "[ERROR] pipeline '" << config_json["name"] << "' has no 'pipelines' or 'nodes' array" << std::endl;
+        return false;
+    }
+
+    std::unordered_map<std::string, int> id_to_node;
+    for (auto obj : pipelines_obj.is_array() ? pipelines_obj : nodes_obj) {
+        pipeline p;
+        p.name = obj["name"];
+        p.components = json_get_string_items("components", obj);
+        p.id = obj["id"].is_string() ? obj["id"].get<std::string>() : std::to_string(nodes->size());
+        p.output = obj["output"].is_string() ? obj["output"].get<std::string>() : "";
+        p.upstream = pipelines_obj.is_array() ? (int)nodes->size() - 1 : -1;
+        p.definition = obj.dump();
+
+        if (!id_to_node.emplace(p.id, (int)nodes->size()).second) {
+            std::cout << "[ERROR] duplicate pipeline node '" << p.id << "'" << std::endl;
+            return false;
+        }
+        nodes->push_back(p);
+    }
+
+    const auto& edges_obj = config_json["edges"];
+    if (pipelines_obj.is_array() || !edges_obj.is_array()) {
+        return true;
+    }
+
+    for (auto obj : edges_obj) {
+        const auto from = id_to_node.find(obj["from"].is_string() ? obj["from"].get<std::string>() : "");
+        const auto to = id_to_node.find(obj["to"].is_string() ? obj["to"].get<std::string>() : "");
+        if (from == id_to_node.end() || to == id_to_node.end()) {
+            std::cout << "[ERROR] edge " << obj.dump() << " refers to unknown pipeline node" << std::endl;
+            return false;
+        }
+        auto& node = (*nodes)[to->second];
+        if (node.upstream >= 0) {
+            std::cout << "[ERROR] pipeline node '" << node.id << "' has more than one upstream node" << std::endl;
+            return false;
+        }
+        node.upstream = from->second;
+    }
+
+    // with single upstream per node, cycle is the only way to not reach a root
+    for (size_t i = 0; i < nodes->size(); ++i) {
+        int upstream = (*nodes)[i].upstream;
+        for (size_t depth = 0; upstream >= 0; ++depth) {
+            if (depth == nodes->size()) {
+                std::cout << "[ERROR] pipeline node '" << (*nodes)[i].id << "' is part of a cycle" << std::endl;
+                return false;
+            }
+            upstream = (*nodes)[upstream].upstream;
+        }
+    }
+
+    return true;
+}
+
+static bool is_upstream_node(const std::vector<pipeline>& nodes, size_t node, size_t upstream)
+{
+    for (int i = nodes[node].upstream; i >= 0; i = nodes[i].upstream) {
+        if ((size_t)i == upstream)
+            return true;
+    }
+    return false;
+}
+
+static std::vector<size_t> count_downstream_nodes(const std::vector<pipeline>& nodes)
+{
+    std::vector<size_t> downstream_count(nodes.size(), 0);
+    for (const auto& node : nodes) {
+        if (node.upstream >= 0)
+            downstream_count[node.upstream]++;
+    }
+    return downstream_count;
+}
+
+// Resolves output file of every node. "output" replaces extension of --output (e.g. ".vrm", ".lod.glb"),
+// nodes without it write to the output of upstream node. Branches running in parallel must not write
+// the same file, nor overwrite the file their siblings are reading from.
+static bool resolve_pipeline_outputs(const std::vector<pipeline>& nodes, std::string output, std::vector<std::string>* outputs)
+{
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const auto& node = nodes[i];
+        if (!node.output.empty()) {
+            outputs->push_back(path_without_extension(output).u8string() + node.output);
+        } else {
+            // upstream always comes first in a chain, but not necessarily in "nodes"
+            int upstream = node.upstream;
+            while (upstream >= 0 && nodes[upstream].output.empty()) {
+                upstream = nodes[upstream].upstream;
+            }
+            outputs->push_back(upstream < 0 ? output : path_without_extension(output).u8string() + nodes[upstream].output);
+        }
+    }
+
+    const auto downstream_count = count_downstream_nodes(nodes);
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (size_t j = 0; j < nodes.size(); ++j) {
+            if (i == j || (*outputs)[i] != (*outputs)[j])
+                continue;
+
+            const bool sequential = is_upstream_node(nodes, i, j) || is_upstream_node(nodes, j, i);
+            const bool fan_out = is_upstream_node(nodes, j, i) && downstream_count[i] > 1;
+            if (!sequential || fan_out) {
+                std::cout << "[ERROR] pipeline nodes '" << nodes[i].id << "' and '" << nodes[j].id << "' write the same output " << (*outputs)[i] << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Files components read through the output config: textures of "find_missing_textures_from" directories,
+// relative to the output config file (see gltf_override_find_missing_textures)
+static void hash_config_assets(const json& object, const fs::path& config_dir, build_cache_hash* hash)
+{
+    if (object.is_array()) {
+        for (const auto& item : object) {
+            hash_config_assets(item, config_dir, hash);
+        }
+        return;
+    }
+    if (!object.is_object())
+        return;
+
+    for (const auto& item : object.items()) {
+        if (item.key() != "find_missing_textures_from" || !item.value().is_string()) {
+            hash_config_assets(item.value(), config_dir, hash);
+            continue;
+        }
+
+        std::vector<fs::path> files;
+        std::error_code ec;
+        for (fs::directory_iterator it(config_dir / item.value().get<std::string>(), ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file())
+                files.push_back(it->path());
+        }
+        std::sort(files.begin(), files.end());
+
+        hash->update(item.value().get<std::string>());
+        for (const auto& file : files) {
+            hash->update(file.filename().u8string());
+            hash->update_file(file.u8string());
+        }
+    }
+}
+
+// Everything outside of the pipeline definition that changes the result of a job.
+// The build itself is identified by AVATAR_BUILD_VERSION, rebuilding the same source keeps the cache.
+static build_cache_hash hash_job_inputs(const job_context* context)
+{
+    const auto options = context->options;
+
+    build_cache_hash hash;
+    hash.update(std::string(AVATAR_BUILD_VERSION));
+    hash.update_file(context->input);
+    hash.update_file(options->input_config);
+    hash.update_file(options->output_config);
+    hash_config_assets(options->output_config_json, fs::path(options->output_config).parent_path(), &hash);
+
+    // fbx2gltf is external tool, its path, size and timestamp tell versions apart without reading it
+    std::error_code ec;
+    hash.update(options->fbx2gltf);
+    hash.update(std::to_string(fs::file_size(options->fbx2gltf, ec)));
+    hash.update(std::to_string(fs::last_write_time(options->fbx2gltf, ec).time_since_epoch().count()));
+
+    // generated file names are based on output file name
+    hash.update(context->output);
+
+    // SIMD kernels are not bit-identical to scalar ones, the level in use is part of the result.
+    // --debug writes JSON dumps next to outputs.
+    hash.update(std::string(gltf_simd_level_name(gltf_get_simd_level())));
+    hash.update(std::string(options->debug ? "debug" : "release"));
+
+    return hash;
+}
+
+// Cache key of every node covers the job inputs and all node definitions from root to the node,
+// so that unchanged upstream nodes of a modified pipeline are still found in the cache.
+static void compute_cache_keys(const job_context* context, const std::vector<std::string>& outputs, std::vector<pipeline>* nodes)
+{
+    const auto base = hash_job_inputs(context);
+
+    for (size_t i = 0; i < nodes->size(); ++i) {
+        std::vector<int> chain;
+        for (int node = (int)i; node >= 0; node = (*nodes)[node].upstream) {
+            chain.insert(chain.begin(), node);
+        }
+
+        auto hash = base;
+        for (const auto node : chain) {
+            const auto& p = (*nodes)[node];
+            hash.update(p.definition);
+            hash.update(outputs[node]);
+        }
+        (*nodes)[i].cache_key = hash.hex();
+    }
+}
+
+// Decides which nodes run. A node runs when it is not cached and its result is needed: it is a leaf
+// or one of its downstream nodes runs. Cached nodes restore their files when something needs them.
+// Cached entries stay pinned for the job so that concurrent jobs can't evict them before they are restored.
+static std::vector<pipeline_processor::build_cache_mode> plan_build_cache(const std::vector<pipeline>& nodes, build_cache_pins* pins)
+{
+    std::vector<bool> cached(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        cached[i] = pins->pin(nodes[i].cache_key);
+    }
+
+    const auto downstream_count = count_downstream_nodes(nodes);
+
+    // result of node i is needed by a leaf or a downstream node that runs
+    auto needed = [&](const std::vector<bool>& run, size_t i) {
+        if (downstream_count[i] == 0)
+            return true;
+        for (size_t j = 0; j < nodes.size(); ++j) {
+            if (nodes[j].upstream == (int)i && run[j])
+                return true;
+        }
+        return false;
+    };
+
+    std::vector<bool> run(nodes.size(), false);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!run[i] && !cached[i] && needed(run, i)) {
+                run[i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    std::vector<pipeline_processor::build_cache_mode> modes(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (run[i]) {
+            modes[i] = pipeline_processor::cache_store;
+        } else if (needed(run, i)) {
+            modes[i] = pipeline_processor::cache_restore;
+        } else {
+            modes[i] = pipeline_processor::cache_skip;
+        }
+    }
+    return modes;
+}
+
+static bool build_and_start_circuits(job_context* context, json config_json)
+{
+    trace_scope trace(fs::path(context->input).filename().u8string(), "job");
+    trace.arg_file("input", context->input);
+
+    try {
+        std::vector<pipeline> nodes;
+        if (!parse_pipeline_graph(config_json, &nodes)) {
+            return false;
+        }
+
+        std::vector<std::string> outputs;
+        if (!resolve_pipeline_outputs(nodes, context->output, &outputs)) {
+            return false;
+        }
+
+        const auto cache = context->options->cache;
+        std::vector<pipeline_processor::build_cache_mode> cache_modes(nodes.size(), pipeline_processor::cache_none);
+        std::unique_ptr<build_cache_pins> cache_pins;
+        if (cache != nullptr) {
+            cache_pins.reset(new build_cache_pins(cache));
+            compute_cache_keys(context, outputs, &nodes);
+            cache_modes = plan_build_cache(nodes, cache_pins.get());
+        }
+
+        // every node owns a job context, it's overwritten by upstream context when the node starts
+        std::vector<job_context> contexts(nodes.size(), *context);
+
+        auto circuit = std::make_shared<DSPatch::Circuit>();
+
+        std::vector<std::shared_ptr<pipeline_processor>> pipelines;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            contexts[i].output = outputs[i];
+
+            auto component = wire_pipeline(&nodes[i], &contexts[i]);
+            circuit->AddComponent(component);
+
+            if (!nodes[i].output.empty()) {
+                component->set_output(outputs[i]);
+            }
+            component->set_cache(cache_modes[i], nodes[i].cache_key);
+
+            pipelines.push_back(component);
+        }
+
+        const auto downstream_count = count_downstream_nodes(nodes);
+
+        std::vector<size_t> handoff_count(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].upstream < 0)
+                continue;
+
+            const auto upstream = pipelines[nodes[i].upstream];
+            const auto component = pipelines[i];
+            circuit->ConnectOutToIn(upstream, 0, component, 0);
+            circuit->ConnectOutToIn(upstream, 2, component, 2);
+
+            // pass cgltf_data* in memory between gltf_pipelines instead of writing and reading file.
+            // each branch gets its own clone of upstream data. cached nodes don't process any data.
+            const bool processed = cache_modes[nodes[i].upstream] <= pipeline_processor::cache_store && cache_modes[i] <= pipeline_processor::cache_store;
+            if (processed && upstream->accepts_data() && component->accepts_data()) {
+                component->set_handoff_index(handoff_count[nodes[i].upstream]++);
+                circuit->ConnectOutToIn(upstream, 1, component, 1);
+            }
+        }
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (handoff_count[i] > 0) {
+                pipelines[i]->set_handoff(handoff_count[i], handoff_count[i] < downstream_count[i]);
+            }
+        }
+
+        // pipelines share nothing but the job context passed from upstream: each pipeline waits for
+        // its upstream before processing and independent branches run in parallel.
+        circuit->Tick(DSPatch::Component::TickMode::Parallel);
+
+        // Check if pipeline has failure
+        for (const auto pipeline : pipelines) {
+            if (pipeline->is_discarded())
+                return false;
+        }
+
+        return true;
+    } catch (json::exception& e) {
+        std::cout << "[ERROR] error while parsing pipeline '" << config_json["name"] << "'" << std::endl;
+        std::cout << "\t " << e.what() << std::endl;
+        return false;
+    }
+}
+
+static bool start_pipelines(const cmd_options* options)
+{
+    json config_json;
+
+    if (!json_parse(options->config, &config_json)) {
+        return false;
+    }
+
+    if (options->verbose) {
+        std::cout << "[INFO] Starting pipeline '" << config_json["name"] << "'" << std::endl;
+        std::cout << "[INFO] " << config_json["description"] << std::endl;
+    }
+
+    job_context context = { options, options->input, options->output };
+
+    return build_and_start_circuits(&context, config_json);
+}
@@ -1,162 +1,293 @@
-/* avatar-build is distributed under MIT license:
- *
- * Copyright (c) 2021 Kota Iguchi
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
- * SOFTWARE.
- */
-#pragma once
-
-#include "DSPatch.h"
-#include <string>
-#include <iostream>
-#include <vector>
-#include <unordered_map>
-
-static bool pipeline_leackcheck_enabled = false;
-static bool pipeline_verbose_enabled = false;
-
-#define AVATAR_PIPELINE_LOG(msg)  if (pipeline_verbose_enabled) std::cout << msg << std::endl;
-
-static fs::path path_without_extension(std::string fullpath)
-{
-    fs::path p = fullpath;
-    return p.parent_path() / p.stem();
-}
-
-namespace AvatarBuild {
-
-struct cmd_options {
-    std::string config;
-    std::string input;
-    std::string output;
-    std::string input_config;
-    std::string output_config;
-    std::string fbx2gltf;
-    bool verbose;
-    bool debug;
-    cgltf_options gltf_options;
-    
-    nlohmann::json input_config_json;
-    nlohmann::json output_config_json;
-
-    // Used when pipeline creates new files or changes input/output file name
-    std::vector<std::string> input_override;
-    std::vector<std::string> output_override;
-};
-
-struct pipeline {
-    std::string name;
-    std::vector<std::string> components;
-};
-
-struct bone {
-    std::string name;
-    cgltf_float rotation[4];
-};
-
-struct pose {
-    std::string name;
-    std::vector<bone> bones;
-};
-
-struct bone_mappings {
-    std::unordered_map<std::string, pose> poses;
-    std::unordered_map<std::string, cgltf_node*> name_to_node;  // bone name, node
-    std::unordered_map<std::string, cgltf_int> node_index_map; // node->name, node index
-};
-
-// A component that just get result from signal bus
-class components_result final : public DSPatch::Component {
-public:
-    components_result()
-        : DSPatch::Component()
-        , discarded(false)
-    {
-        SetInputCount_(1);
-        SetOutputCount_(0);
-    }
-
-    bool is_discarded() {
-        return discarded;
-    }
-protected:
-    virtual void Process_(DSPatch::SignalBus const& inputs, DSPatch::SignalBus&) override
-    {
-        const auto input0 = inputs.GetValue<bool>(0);
-        if (input0 && *input0) {
-            discarded = *input0;
-        }
-    }
-    bool discarded;
-};
-
-class pipeline_processor : public DSPatch::Component {
-
-public:
-    pipeline_processor(std::string name, cmd_options* options)
-        : Component()
-        , name(name)
-        , options(options)
-        , circuit(std::make_shared<DSPatch::Circuit>())
-        , tick_result(std::make_shared<components_result>())
-    {
-    }
-
-    virtual ~pipeline_processor()
-    {
-    }
-
-    void add_component(std::shared_ptr<DSPatch::Component> next)
-    {
-        circuit->AddComponent(next);
-        if (!components.empty()) {
-            const auto back = components.back();
-            circuit->ConnectOutToIn(back, 0, next, 0); // <bool>  discarded
-            circuit->ConnectOutToIn(back, 1, next, 1); // <void*> data1
-            circuit->ConnectOutToIn(back, 2, next, 2); // <void*> data2
-            circuit->ConnectOutToIn(back, 3, next, 3); // <void*> data3
-        }
-        components.push_back(next);
-    }
-
-    virtual void wire_components()
-    {
-        circuit->AddComponent(tick_result);
-        circuit->ConnectOutToIn(components.back(), 0, tick_result, 0); // <bool>  discarded
-    }
-
-    bool is_discarded() 
-    {
-        return tick_result->is_discarded();
-    }
-
-protected:
-    virtual void Process_(DSPatch::SignalBus const&, DSPatch::SignalBus&) override
-    {
-        AVATAR_PIPELINE_LOG("[WARN] No Pipeline is connected for '" << name << "'");
-    }
-
-    std::string name;
-    cmd_options* options;
-    std::shared_ptr<DSPatch::Circuit> circuit;
-    std::shared_ptr<components_result> tick_result;
-    std::vector<std::shared_ptr<DSPatch::Component>> components;
-};
-
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "DSPatch.h"
+#include <string>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+
+static bool pipeline_leackcheck_enabled = false;
+static bool pipeline_verbose_enabled = false;
+static bool pipeline_simd_enabled = false; // SIMD kernels are not bit-identical to scalar, see simd_check_func.inl
+static size_t pipeline_threads_count = 0; // 0: use all hardware threads
+
+#define AVATAR_PIPELINE_LOG(msg)  if (pipeline_verbose_enabled) std::cout << msg << std::endl;
+
+static fs::path path_without_extension(std::string fullpath)
+{
+    fs::path p = fullpath;
+    return p.parent_path() / p.stem();
+}
+
+#include "build_cache.hpp"
+#include "leak_check.hpp"
+#include "alloc_profile.hpp"
+#include "trace.hpp"
+#include "memory_files.hpp"
+
+namespace AvatarBuild {
+
+// Command line options and parsed configs. Read-only once pipelines start,
+// so one instance can be shared between jobs running at the same time.
+struct cmd_options {
+    std::string config;
+    std::string input;
+    std::string output;
+    std::string input_config;
+    std::string output_config;
+    std::string fbx2gltf;
+    bool verbose;
+    bool debug;
+    cgltf_options gltf_options;
+    
+    nlohmann::json input_config_json;
+    nlohmann::json output_config_json;
+
+    build_cache* cache; // nullptr: build cache is disabled
+};
+
+// State of a single build. Pipelines redirect input/output here while they run,
+// each job owns its context and cmd_options stays untouched.
+struct job_context {
+    const cmd_options* options;
+    std::string input;
+    std::string output;
+
+    // Used when pipeline creates new files or changes input/output file name
+    std::vector<std::string> input_override;
+    std::vector<std::string> output_override;
+
+    memory_files* memory; // nullptr: files are read from and written to disk
+};
+
+struct pipeline {
+    std::string name;
+    std::vector<std::string> components;
+
+    // pipeline graph node: id, output file (empty: same as upstream) and upstream node index (-1: none)
+    std::string id;
+    std::string output;
+    int upstream;
+
+    // node JSON as written in the pipeline file and build cache key of the result of this node
+    std::string definition;
+    std::string cache_key;
+};
+
+struct bone {
+    std::string name;
+    cgltf_float rotation[4];
+};
+
+struct pose {
+    std::string name;
+    std::vector<bone> bones;
+};
+
+struct bone_mappings {
+    std::unordered_map<std::string, pose> poses;
+    std::unordered_map<std::string, cgltf_node*> name_to_node;  // bone name, node
+    std::unordered_map<std::string, cgltf_int> node_index_map; // node->name, node index
+};
+
+// A component that just get result from signal bus
+class components_result final : public DSPatch::Component {
+public:
+    components_result()
+        : DSPatch::Component()
+        , discarded(false)
+    {
+        SetInputCount_(1);
+        SetOutputCount_(0);
+    }
+
+    bool is_discarded() {
+        return discarded;
+    }
+protected:
+    virtual void Process_(DSPatch::SignalBus const& inputs, DSPatch::SignalBus&) override
+    {
+        const auto input0 = inputs.GetValue<bool>(0);
+        if (input0 && *input0) {
+            discarded = *input0;
+        }
+    }
+    bool discarded;
+};
+
+class pipeline_processor : public DSPatch::Component {
+
+public:
+    pipeline_processor(std::string name, job_context* context)
+        : Component()
+        , name(name)
+        , context(context)
+        , circuit(std::make_shared<DSPatch::Circuit>())
+        , tick_result(std::make_shared<components_result>())
+        , handoff(0)
+        , handoff_write(false)
+        , handoff_index(0)
+        , cache_mode(cache_none)
+    {
+        SetInputCount_(3);  // <bool> discarded, <std::vector<cgltf_data*>> data, <job_context*> upstream context
+        SetOutputCount_(3); // <bool> discarded, <std::vector<cgltf_data*>> data, <job_context*> context
+    }
+
+    virtual ~pipeline_processor()
+    {
+    }
+
+    void add_component(std::shared_ptr<DSPatch::Component> next)
+    {
+        circuit->AddComponent(next);
+        if (!components.empty()) {
+            const auto back = components.back();
+            circuit->ConnectOutToIn(back, 0, next, 0); // <bool>  discarded
+            circuit->ConnectOutToIn(back, 1, next, 1); // <void*> data1
+            circuit->ConnectOutToIn(back, 2, next, 2); // <void*> data2
+            circuit->ConnectOutToIn(back, 3, next, 3); // <void*> data3 (gltf_mesh_index*)
+        }
+        components.push_back(next);
+    }
+
+    virtual void wire_components()
+    {
+        circuit->AddComponent(tick_result);
+        circuit->ConnectOutToIn(components.back(), 0, tick_result, 0); // <bool>  discarded
+    }
+
+    bool is_discarded() 
+    {
+        return tick_result->is_discarded();
+    }
+
+    // true when the pipeline can take cgltf_data* from previous pipeline (input 1) instead of reading input file
+    virtual bool accepts_data() const
+    {
+        return false;
+    }
+
+    // pass cgltf_data* to count downstream pipelines (output 1) instead of writing output file,
+    // each of them gets its own clone. write_output: output file is still needed by other downstream
+    void set_handoff(size_t count, bool write_output)
+    {
+        handoff = count;
+        handoff_write = write_output;
+    }
+
+    // which one of cgltf_data* passed from upstream pipeline (input 1) belongs to this pipeline
+    void set_handoff_index(size_t index)
+    {
+        handoff_index = index;
+    }
+
+    enum build_cache_mode {
+        cache_none,    // build cache is disabled
+        cache_store,   // process and store result
+        cache_restore, // result is cached, restore it for downstream pipelines
+        cache_skip     // result is not needed, all downstream pipelines are cached
+    };
+
+    void set_cache(build_cache_mode mode, std::string key)
+    {
+        cache_mode = mode;
+        cache_key = key;
+    }
+
+    // write result to given output instead of the one inherited from upstream pipeline
+    void set_output(std::string output)
+    {
+        branch_output = output;
+    }
+
+protected:
+    virtual void Process_(DSPatch::SignalBus const& inputs, DSPatch::SignalBus& outputs) override
+    {
+        AVATAR_PIPELINE_LOG("[WARN] No Pipeline is connected for '" << name << "'");
+        inherit_context(inputs, outputs);
+    }
+
+    // Copies job context of upstream pipeline (input 2) into our own and passes it to downstream
+    // pipelines (output 2). Every branch works on its own copy of the upstream result.
+    void inherit_context(DSPatch::SignalBus const& inputs, DSPatch::SignalBus& outputs)
+    {
+        const auto upstream = inputs.GetValue<job_context*>(2);
+        if (upstream && *upstream) {
+            *context = **upstream;
+        }
+        if (!branch_output.empty()) {
+            context->output = branch_output;
+        }
+        outputs.SetValue(2, context);
+    }
+
+    // Takes result from build cache instead of processing, true when the pipeline is done.
+    // Called after inherit_context() so that restored state is passed to downstream.
+    bool restore_cached(DSPatch::SignalBus& outputs)
+    {
+        if (cache_mode == cache_skip) {
+            AVATAR_PIPELINE_LOG("[INFO] " << name << " skipped, downstream is cached");
+            outputs.SetValue(0, false);
+            return true;
+        }
+
+        build_cache_state state;
+        if (cache_mode == cache_restore && context->options->cache->restore(cache_key, &state)) {
+            AVATAR_PIPELINE_LOG("[INFO] " << name << " restored from build cache " << cache_key);
+            context->input = state.input;
+            context->output = state.output;
+            context->input_override = state.input_override;
+            context->output_override = state.output_override;
+            outputs.SetValue(0, false);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Stores files produced by the pipeline along with job state
+    void store_cached(const std::vector<std::string>& files)
+    {
+        if (cache_mode == cache_none || files.empty())
+            return;
+
+        const build_cache_state state = { context->input, context->output, context->input_override, context->output_override };
+        context->options->cache->store(cache_key, state, files);
+    }
+
+    std::string name;
+    job_context* context;
+    std::shared_ptr<DSPatch::Circuit> circuit;
+    std::shared_ptr<components_result> tick_result;
+    std::vector<std::shared_ptr<DSPatch::Component>> components;
+    size_t handoff;
+    bool handoff_write;
+    size_t handoff_index;
+    std::string branch_output;
+    build_cache_mode cache_mode;
+    std::string cache_key;
+};
+
 } // namespace Avatar
\ No newline at end of file
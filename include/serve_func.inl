@@ -0,0 +1,559 @@
+/* distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Build server: jobs are sent as JSON lines over stdin/stdout or a Unix domain socket,
+//
+//   {"id": 1, "input": "a.fbx", "output": "a.vrm", "pipeline": "...", "input_config": "...", "output_config": "..."}
+//
+// "pipeline", "input_config" and "output_config" are optional, command line options are used
+// when they are missing. Every job is answered with "accepted", "running" and then "done" or
+// "failed" lines carrying the same "id". {"command": "status"} reports queue state and
+// {"command": "shutdown"} stops the server once running jobs are finished.
+
+static volatile sig_atomic_t serve_signal_received = 0;
+
+static void serve_signal_handler(int)
+{
+    serve_signal_received = 1;
+}
+
+// identifies a version of the file without reading it, empty when there's no file
+static std::string serve_file_stamp(const std::string& path)
+{
+    if (path.empty())
+        return "";
+
+    std::error_code ec;
+    const auto size = fs::file_size(path, ec);
+    const auto time = fs::last_write_time(path, ec);
+    if (ec)
+        return "<missing>";
+
+    return std::to_string(size) + ":" + std::to_string(time.time_since_epoch().count());
+}
+
+// Client of the build server. Responses of concurrent jobs are written line by line,
+// jobs keep the connection open until their last response is sent.
+class serve_connection {
+public:
+    explicit serve_connection(std::ostream* out)
+        : out(out)
+        , fd(-1)
+    {
+    }
+
+    explicit serve_connection(int fd)
+        : out(nullptr)
+        , fd(fd)
+    {
+    }
+
+    ~serve_connection()
+    {
+#ifndef WIN32
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    void send(const json& message)
+    {
+        const auto line = message.dump() + "\n";
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (out != nullptr) {
+            *out << line;
+            out->flush();
+            return;
+        }
+#ifndef WIN32
+        // client may be gone already, remaining responses are dropped
+        size_t written = 0;
+        while (written < line.size()) {
+            const auto n = ::send(fd, line.data() + written, line.size() - written, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            written += (size_t)n;
+        }
+#endif
+    }
+
+#ifndef WIN32
+    // false on end of stream or when the server is stopping
+    bool read_line(std::string* line, const std::atomic<bool>& stopping)
+    {
+        for (;;) {
+            const auto eol = buffer.find('\n');
+            if (eol != std::string::npos) {
+                *line = buffer.substr(0, eol);
+                buffer.erase(0, eol + 1);
+                return true;
+            }
+
+            pollfd pfd = { fd, POLLIN, 0 };
+            const int ready = ::poll(&pfd, 1, 200);
+            if (stopping || serve_signal_received)
+                return false;
+            if (ready < 0 && errno != EINTR)
+                return false;
+            if (ready <= 0)
+                continue;
+
+            char chunk[4096];
+            const auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, (size_t)n);
+        }
+    }
+#endif
+
+private:
+    std::ostream* out;
+    int fd;
+    std::string buffer;
+    std::mutex mutex;
+};
+
+struct serve_job {
+    json id;
+    std::string input;
+    std::string output;
+    std::shared_ptr<const json> pipeline;
+    std::shared_ptr<const cmd_options> options;
+    std::shared_ptr<serve_connection> connection;
+    std::chrono::steady_clock::time_point accepted;
+};
+
+class build_server {
+public:
+    build_server(const cmd_options* defaults, size_t workers_count)
+        : defaults(defaults)
+        , stopping(false)
+        , running(0)
+        , succeeded(0)
+        , failed(0)
+    {
+        if (workers_count == 0) {
+            workers_count = std::thread::hardware_concurrency();
+        }
+        if (workers_count == 0) {
+            workers_count = 1;
+        }
+        for (size_t i = 0; i < workers_count; ++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~build_server()
+    {
+        stop();
+    }
+
+    // Parses default pipeline and configs up front, so that the first job doesn't pay for it
+    bool warm_up()
+    {
+        std::string error;
+        return get_pipeline(defaults->config, &error) && get_options(defaults->input_config, defaults->output_config, &error);
+    }
+
+    // Handles one request line, false when the client asked the server to shut down
+    bool handle(const std::string& line, std::shared_ptr<serve_connection> connection)
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            return true;
+
+        const auto request = json::parse(line, nullptr, false);
+        if (!request.is_object()) {
+            connection->send({ { "status", "error" }, { "error", "request is not a JSON object" } });
+            return true;
+        }
+
+        const json id = request.contains("id") ? request["id"] : json();
+
+        if (request.contains("command")) {
+            const auto command = request["command"].is_string() ? request["command"].get<std::string>() : "";
+            if (command == "status") {
+                std::lock_guard<std::mutex> lock(mutex);
+                connection->send({ { "id", id }, { "status", "ready" }, { "queued", queue.size() }, { "running", running }, { "succeeded", succeeded }, { "failed", failed }, { "workers", workers.size() } });
+                return true;
+            }
+            if (command == "shutdown") {
+                connection->send({ { "id", id }, { "status", "shutdown" } });
+                return false;
+            }
+            connection->send({ { "id", id }, { "status", "error" }, { "error", "unknown command '" + command + "'" } });
+            return true;
+        }
+
+        serve_job job;
+        job.id = id;
+        job.connection = connection;
+
+        std::string error;
+        const auto pipeline_path = request_string(request, "pipeline", defaults->config);
+        const auto input_config = request_string(request, "input_config", defaults->input_config);
+        const auto output_config = request_string(request, "output_config", defaults->output_config);
+        job.input = request_string(request, "input", "");
+        job.output = request_string(request, "output", "");
+
+        if (job.input.empty() || job.output.empty()) {
+            error = "'input' and 'output' are required";
+        } else if (job.input == job.output) {
+            error = "Input and Output file should not be same: " + job.input;
+        } else if (!fs::exists(job.input)) {
+            error = "Input file not found: " + job.input;
+        } else {
+            job.pipeline = get_pipeline(pipeline_path, &error);
+            if (job.pipeline) {
+                job.options = get_options(input_config, output_config, &error);
+            }
+        }
+
+        if (!error.empty()) {
+            connection->send({ { "id", id }, { "status", "error" }, { "error", error } });
+            return true;
+        }
+
+        job.accepted = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(job);
+        connection->send({ { "id", id }, { "status", "accepted" }, { "queued", queue.size() } });
+        condition.notify_one();
+
+        return true;
+    }
+
+    // Waits until queued and running jobs are finished
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+private:
+    static std::string request_string(const json& request, const char* key, const std::string& default_value)
+    {
+        if (request.contains(key) && request[key].is_string())
+            return request[key].get<std::string>();
+        return default_value;
+    }
+
+    std::shared_ptr<const json> get_pipeline(const std::string& path, std::string* error)
+    {
+        const auto stamp = serve_file_stamp(path);
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto& entry = pipelines[path];
+        if (entry.pipeline && entry.stamp == stamp)
+            return entry.pipeline;
+
+        auto pipeline = std::make_shared<json>();
+        if (!json_parse(path, pipeline.get())) {
+            *error = "failed to parse pipeline " + path;
+            pipelines.erase(path);
+            return nullptr;
+        }
+        AVATAR_PIPELINE_LOG("[INFO] serve: loaded pipeline " << path);
+
+        entry.stamp = stamp;
+        entry.pipeline = pipeline;
+        return entry.pipeline;
+    }
+
+    std::shared_ptr<const cmd_options> get_options(const std::string& input_config, const std::string& output_config, std::string* error)
+    {
+        const auto key = input_config + "\n" + output_config;
+        const auto stamp = serve_file_stamp(input_config) + "\n" + serve_file_stamp(output_config);
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto& entry = options[key];
+        if (entry.options && entry.stamp == stamp)
+            return entry.options;
+
+        auto parsed = std::make_shared<cmd_options>(*defaults);
+        parsed->input_config = input_config;
+        parsed->output_config = output_config;
+        parsed->input_config_json = json();
+        parsed->output_config_json = json();
+        if (!input_config.empty() && !json_parse(input_config, &parsed->input_config_json)) {
+            *error = "Unable to load " + input_config;
+            options.erase(key);
+            return nullptr;
+        }
+        if (!output_config.empty() && !json_parse(output_config, &parsed->output_config_json)) {
+            *error = "Unable to load " + output_config;
+            options.erase(key);
+            return nullptr;
+        }
+        AVATAR_PIPELINE_LOG("[INFO] serve: loaded configs " << input_config << " " << output_config);
+
+        entry.stamp = stamp;
+        entry.options = parsed;
+        return entry.options;
+    }
+
+    void work()
+    {
+        for (;;) {
+            serve_job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                job = queue.front();
+                queue.pop_front();
+                ++running;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto queue_ms = std::chrono::duration<double, std::milli>(start - job.accepted).count();
+            job.connection->send({ { "id", job.id }, { "status", "running" }, { "queue_ms", queue_ms } });
+
+            job_context context = { job.options.get(), job.input, job.output };
+            const bool success = build_and_start_circuits(&context, *job.pipeline);
+
+            const auto elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            job.connection->send({ { "id", job.id }, { "status", success ? "done" : "failed" }, { "input", job.input }, { "output", job.output }, { "queue_ms", queue_ms }, { "elapsed_ms", elapsed_ms } });
+
+            // trace events of finished jobs go to the file, the server doesn't keep them
+            if (pipeline_trace != nullptr) {
+                pipeline_trace->flush();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            --running;
+            if (success) {
+                ++succeeded;
+            } else {
+                ++failed;
+            }
+        }
+    }
+
+    struct cache_entry {
+        std::string stamp;
+        std::shared_ptr<const json> pipeline;
+        std::shared_ptr<const cmd_options> options;
+    };
+
+    const cmd_options* defaults;
+
+    std::mutex cache_mutex;
+    std::unordered_map<std::string, cache_entry> pipelines;
+    std::unordered_map<std::string, cache_entry> options;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<serve_job> queue;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping;
+    size_t running;
+    size_t succeeded;
+    size_t failed;
+};
+
+// JSON lines over stdin/stdout until end of input
+static bool serve_stdio(build_server* server, std::ostream* responses)
+{
+    auto connection = std::make_shared<serve_connection>(responses);
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (!server->handle(line, connection))
+            break;
+    }
+    server->stop();
+
+    return true;
+}
+
+#ifndef WIN32
+// Unix domain socket at path, every client connection is read on its own thread and
+// jobs of all clients share the worker pool. Stops on SIGINT/SIGTERM or "shutdown" command.
+static bool serve_socket(build_server* server, const std::string& path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "[ERROR] socket path is too long: " << path << std::endl;
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    const int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cout << "[ERROR] failed to create socket " << path << std::endl;
+        return false;
+    }
+
+    // stale socket of previous run
+    std::error_code ec;
+    if (fs::status(path, ec).type() == fs::file_type::socket) {
+        fs::remove(path, ec);
+    }
+
+    // socket file is only for the current user: anyone who can connect can run jobs that read and write files
+    // as this process. Workers are idle until the first connection, nothing else creates files meanwhile.
+    const mode_t old_umask = ::umask(0077);
+    const bool bound = ::bind(listen_fd, (const sockaddr*)&addr, sizeof(addr)) == 0;
+    ::umask(old_umask);
+
+    if (!bound || ::listen(listen_fd, 64) != 0) {
+        std::cout << "[ERROR] failed to listen on " << path << ": " << strerror(errno) << std::endl;
+        ::close(listen_fd);
+        return false;
+    }
+
+    // clients closing early must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, serve_signal_handler);
+    std::signal(SIGTERM, serve_signal_handler);
+
+    std::cout << "[INFO] serving on " << path << std::endl;
+
+    struct client {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    std::atomic<bool> shutdown_requested { false };
+    std::list<client> clients;
+    while (!shutdown_requested && !serve_signal_received) {
+        // join threads of disconnected clients
+        for (auto it = clients.begin(); it != clients.end();) {
+            if (*it->done) {
+                it->thread.join();
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, 200) <= 0)
+            continue;
+
+        const int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        std::thread thread([server, fd, done, &shutdown_requested]() {
+            auto connection = std::make_shared<serve_connection>(fd);
+            std::string line;
+            while (connection->read_line(&line, shutdown_requested)) {
+                if (!server->handle(line, connection)) {
+                    shutdown_requested = true;
+                    break;
+                }
+            }
+            *done = true;
+        });
+        clients.push_back({ std::move(thread), done });
+    }
+
+    ::close(listen_fd);
+    ::unlink(path.c_str());
+
+    for (auto& c : clients) {
+        c.thread.join();
+    }
+    server->stop();
+
+    std::cout << "[INFO] server stopped" << std::endl;
+    return true;
+}
+#endif
+
+static bool start_server(const cmd_options* options, std::string socket_path, size_t workers_count)
+{
+#ifdef WIN32
+    if (socket_path != "-") {
+        std::cout << "[WARN] Unix domain socket is not supported, serving on stdin/stdout" << std::endl;
+        socket_path = "-";
+    }
+#endif
+
+    // stdout carries nothing but responses when serving on stdin/stdout, log output goes to stderr
+    std::ostream responses(std::cout.rdbuf());
+    std::streambuf* log_buffer = nullptr;
+    if (socket_path == "-") {
+        log_buffer = std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
+    bool success = false;
+    {
+        build_server server(options, workers_count);
+        if (!server.warm_up()) {
+            std::cout << "[ERROR] failed to load pipeline or configs" << std::endl;
+        } else if (socket_path == "-") {
+            success = serve_stdio(&server, &responses);
+        } else {
+#ifndef WIN32
+            success = serve_socket(&server, socket_path);
+#endif
+        }
+    }
+
+    if (log_buffer != nullptr) {
+        std::cout.rdbuf(log_buffer);
+    }
+
+    return success;
+}
@@ -0,0 +1,329 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Correctness check of the SIMD kernels against their scalar reference (avatar-bench --check).
+// SIMD skinning blends the joint skin matrices with FMA in a different order, so POSITION,
+// NORMAL and TANGENT may differ from gltf_skin_kernel_scalar by rounding: they have to stay within
+// simd_check_epsilon relative to the reference. Bounds kernels only compare values and must match exactly.
+static const float simd_check_epsilon = 1e-4f;
+
+// interleaved POSITION, NORMAL, TANGENT with padding, or tightly packed separate streams
+struct simd_check_vertices {
+    std::vector<uint8_t> positions;
+    std::vector<uint8_t> normals;
+    std::vector<uint8_t> tangents;
+    cgltf_size positions_stride = 0;
+    cgltf_size normals_stride = 0;
+    cgltf_size tangents_stride = 0;
+    cgltf_size normals_offset = 0;
+    cgltf_size tangents_offset = 0;
+    bool interleaved = false;
+
+    gltf_skin_stream stream(const std::vector<cgltf_uint>& joints, const std::vector<cgltf_float>& weights)
+    {
+        gltf_skin_stream stream = {};
+        stream.positions = positions.data();
+        stream.positions_stride = positions_stride;
+        if (normals_stride > 0) {
+            stream.normals = (interleaved ? positions.data() : normals.data()) + normals_offset;
+            stream.normals_stride = normals_stride;
+        }
+        if (tangents_stride > 0) {
+            stream.tangents = (interleaved ? positions.data() : tangents.data()) + tangents_offset;
+            stream.tangents_stride = tangents_stride;
+        }
+        stream.joints = joints.data();
+        stream.weights = weights.data();
+        return stream;
+    }
+};
+
+static glm::mat4 simd_check_random_matrix(std::mt19937& random)
+{
+    std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+    std::uniform_real_distribution<float> offset(-2.f, 2.f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.f);
+    const glm::vec3 axis = glm::normalize(glm::vec3(offset(random), offset(random), offset(random)) + glm::vec3(0.01f));
+    const float s = scale(random);
+    return glm::translate(glm::mat4(1.f), glm::vec3(offset(random), offset(random), offset(random)))
+        * glm::mat4(glm::angleAxis(angle(random), axis))
+        * glm::scale(glm::mat4(1.f), glm::vec3(s, random() % 4 == 0 ? -s : s, s));
+}
+
+static gltf_skin_palette simd_check_random_palette(std::mt19937& random, cgltf_size joints_count)
+{
+    gltf_skin_palette palette;
+    palette.global_transform = simd_check_random_matrix(random);
+    palette.joint_matrices.resize(joints_count);
+    palette.skin_matrices.resize(joints_count);
+    palette.normal_matrices.resize(joints_count);
+    for (cgltf_size i = 0; i < joints_count; ++i) {
+        palette.joint_matrices[i] = simd_check_random_matrix(random);
+        gltf_update_skin_palette_joint(&palette, i);
+    }
+    return palette;
+}
+
+// Random influences mixed with the cases kernels treat specially: a single joint of weight 1,
+// zero and negative weights, out of range joints and weights that do not sum up to 1
+static void simd_check_random_influences(std::mt19937& random, cgltf_size joints_count, cgltf_uint* joints, cgltf_float* weights)
+{
+    std::uniform_real_distribution<float> weight(0.f, 1.f);
+    for (cgltf_size k = 0; k < 4; ++k) {
+        joints[k] = (cgltf_uint)(random() % joints_count);
+        weights[k] = 0.f;
+    }
+
+    switch (random() % 6) {
+    case 0:
+        weights[random() % 4] = 1.f;
+        break;
+    case 1:
+        // single influence below 1 and a negative one
+        weights[0] = weight(random);
+        weights[1] = -weight(random);
+        break;
+    case 2:
+        joints[random() % 4] = random() % 2 == 0 ? (cgltf_uint)joints_count : 0xffffffffu;
+        weights[0] = weights[1] = weights[2] = weights[3] = 0.25f;
+        break;
+    case 3:
+        weights[0] = weight(random) * 2.f;
+        weights[2] = weight(random);
+        break;
+    default: {
+        float sum = 0.f;
+        for (cgltf_size k = 0; k < 4; ++k) {
+            weights[k] = weight(random);
+            sum += weights[k];
+        }
+        for (cgltf_size k = 0; k < 4; ++k) {
+            weights[k] /= sum;
+        }
+        break;
+    }
+    }
+}
+
+static simd_check_vertices simd_check_random_vertices(std::mt19937& random, cgltf_size count, bool interleaved, bool normals, bool tangents)
+{
+    std::uniform_real_distribution<float> value(-1.f, 1.f);
+    simd_check_vertices vertices;
+    vertices.interleaved = interleaved;
+    if (interleaved) {
+        // position, normal, tangent and 8 bytes of unrelated data
+        vertices.positions_stride = vertices.normals_stride = vertices.tangents_stride = 48;
+        vertices.normals_offset = 12;
+        vertices.tangents_offset = 24;
+        vertices.positions.resize(count * 48);
+    } else {
+        vertices.positions_stride = 12;
+        vertices.normals_stride = 12;
+        vertices.tangents_stride = 16;
+        vertices.positions.resize(count * 12);
+        vertices.normals.resize(count * 12);
+        vertices.tangents.resize(count * 16);
+    }
+    if (!normals)
+        vertices.normals_stride = 0;
+    if (!tangents)
+        vertices.tangents_stride = 0;
+
+    for (auto& byte : vertices.positions)
+        byte = (uint8_t)random();
+
+    for (cgltf_size i = 0; i < count; ++i) {
+        cgltf_float* position = (cgltf_float*)(vertices.positions.data() + vertices.positions_stride * i);
+        cgltf_float* normal = (cgltf_float*)((interleaved ? vertices.positions.data() : vertices.normals.data()) + (interleaved ? 48 : 12) * i + vertices.normals_offset);
+        cgltf_float* tangent = (cgltf_float*)((interleaved ? vertices.positions.data() : vertices.tangents.data()) + (interleaved ? 48 : 16) * i + vertices.tangents_offset);
+
+        const glm::vec3 n = glm::normalize(glm::vec3(value(random), value(random), value(random)) + glm::vec3(0.01f));
+        const glm::vec3 t = glm::normalize(glm::cross(n, glm::vec3(0.3f, 1.f, 0.1f)));
+        for (cgltf_size c = 0; c < 3; ++c) {
+            position[c] = value(random) * 2.f;
+            normal[c] = n[c];
+            tangent[c] = t[c];
+        }
+        tangent[3] = random() % 2 == 0 ? 1.f : -1.f;
+    }
+    return vertices;
+}
+
+static bool simd_check_float(float expected, float actual)
+{
+    if (std::isnan(expected) || std::isnan(actual))
+        return std::isnan(expected) && std::isnan(actual);
+    return std::fabs(expected - actual) <= simd_check_epsilon * std::max(1.f, std::fabs(expected));
+}
+
+// Compares components of every vertex in [begin, end), reports the first mismatch
+static bool simd_check_stream(std::string name, const char* attribute, const uint8_t* expected, const uint8_t* actual, cgltf_size stride, cgltf_size components, cgltf_size begin, cgltf_size end)
+{
+    for (cgltf_size i = begin; i < end; ++i) {
+        for (cgltf_size c = 0; c < components; ++c) {
+            const float e = ((const cgltf_float*)(expected + stride * i))[c];
+            const float a = ((const cgltf_float*)(actual + stride * i))[c];
+            if (!simd_check_float(e, a)) {
+                std::cout << "[ERROR] " << name << ": " << attribute << "[" << i << "][" << c << "] " << a << ", expected " << e << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool simd_check_skin_kernel(std::string name, gltf_skin_kernel kernel, std::mt19937& random)
+{
+    static const cgltf_size counts[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33, 1000 };
+    static const cgltf_size joints_counts[] = { 1, 3, 65 };
+
+    bool success = true;
+    cgltf_size cases = 0;
+    for (const auto count : counts) {
+        for (const auto joints_count : joints_counts) {
+            for (int layout = 0; layout < 4 && success; ++layout) {
+                const bool interleaved = (layout & 1) != 0;
+                const bool tangents = (layout & 2) != 0;
+                const gltf_skin_palette palette = simd_check_random_palette(random, joints_count);
+
+                std::vector<cgltf_uint> joints(count * 4);
+                std::vector<cgltf_float> weights(count * 4);
+                for (cgltf_size i = 0; i < count; ++i) {
+                    simd_check_random_influences(random, joints_count, &joints[i * 4], &weights[i * 4]);
+                }
+
+                simd_check_vertices expected = simd_check_random_vertices(random, count, interleaved, true, tangents);
+                simd_check_vertices actual = expected;
+                const gltf_skin_stream expected_stream = expected.stream(joints, weights);
+                const gltf_skin_stream actual_stream = actual.stream(joints, weights);
+
+                // the pipeline skips vertex 0, start at 1 as well to check unaligned ranges
+                const cgltf_size begin = count > 1 && count % 2 == 1 ? 1 : 0;
+                gltf_skin_kernel_scalar(palette, expected_stream, begin, count);
+                kernel(palette, actual_stream, begin, count);
+
+                const std::string case_name = name + " (" + std::to_string(count) + " vertices, " + std::to_string(joints_count) + " joints" + (interleaved ? ", interleaved" : "") + ")";
+                success = simd_check_stream(case_name, "POSITION", expected_stream.positions, actual_stream.positions, expected_stream.positions_stride, 3, 0, count)
+                    && simd_check_stream(case_name, "NORMAL", expected_stream.normals, actual_stream.normals, expected_stream.normals_stride, 3, 0, count)
+                    && (!tangents || simd_check_stream(case_name, "TANGENT", expected_stream.tangents, actual_stream.tangents, expected_stream.tangents_stride, 4, 0, count));
+
+                if (success) {
+                    // min/max of skinned positions as written to the accessor
+                    cgltf_float expected_min[16], expected_max[16], actual_min[16], actual_max[16];
+                    std::fill(expected_min, expected_min + 3, FLT_MAX);
+                    std::fill(expected_max, expected_max + 3, -FLT_MAX);
+                    std::copy(expected_min, expected_min + 3, actual_min);
+                    std::copy(expected_max, expected_max + 3, actual_max);
+                    gltf_bounds_kernel_scalar(expected_stream.positions, expected_stream.positions_stride, 3, 0, count, expected.positions.size(), expected_min, expected_max);
+                    gltf_bounds_kernel_scalar(actual_stream.positions, actual_stream.positions_stride, 3, 0, count, actual.positions.size(), actual_min, actual_max);
+                    success = simd_check_stream(case_name, "min", (const uint8_t*)expected_min, (const uint8_t*)actual_min, 0, 3, 0, 1)
+                        && simd_check_stream(case_name, "max", (const uint8_t*)expected_max, (const uint8_t*)actual_max, 0, 3, 0, 1);
+                }
+                ++cases;
+            }
+        }
+    }
+
+    std::cout << "[CHECK] " << name << ": " << cases << " cases" << (success ? "" : " FAILED") << std::endl;
+    return success;
+}
+
+static bool simd_check_bounds_kernel(std::string name, gltf_bounds_kernel kernel, std::mt19937& random)
+{
+    static const cgltf_size counts[] = { 1, 3, 4, 5, 17, 1000 };
+    static const cgltf_size components_counts[] = { 1, 2, 3, 4, 16 };
+
+    std::uniform_real_distribution<float> value(-100.f, 100.f);
+    bool success = true;
+    cgltf_size cases = 0;
+    for (const auto count : counts) {
+        for (const auto components : components_counts) {
+            for (cgltf_size padding = 0; padding <= 8 && success; padding += 4) {
+                const cgltf_size stride = components * 4 + padding;
+                std::vector<uint8_t> data(stride * count);
+                for (cgltf_size i = 0; i < data.size() / 4; ++i) {
+                    ((cgltf_float*)data.data())[i] = value(random);
+                }
+                // NaN is ignored by both kernels, infinities are regular bounds
+                if (count > 2) {
+                    ((cgltf_float*)data.data())[random() % (data.size() / 4)] = NAN;
+                    ((cgltf_float*)data.data())[random() % (data.size() / 4)] = INFINITY;
+                    ((cgltf_float*)data.data())[random() % (data.size() / 4)] = -INFINITY;
+                }
+
+                cgltf_float expected_min[16], expected_max[16], actual_min[16], actual_max[16];
+                std::fill(expected_min, expected_min + 16, FLT_MAX);
+                std::fill(expected_max, expected_max + 16, -FLT_MAX);
+                std::copy(expected_min, expected_min + 16, actual_min);
+                std::copy(expected_max, expected_max + 16, actual_max);
+
+                // the last element is not padded, as at the end of a buffer
+                const cgltf_size available = stride * (count - 1) + components * 4;
+                gltf_bounds_kernel_scalar(data.data(), stride, components, 0, count, available, expected_min, expected_max);
+                kernel(data.data(), stride, components, 0, count, available, actual_min, actual_max);
+
+                for (cgltf_size c = 0; c < components && success; ++c) {
+                    if (memcmp(&expected_min[c], &actual_min[c], 4) != 0 || memcmp(&expected_max[c], &actual_max[c], 4) != 0) {
+                        std::cout << "[ERROR] " << name << " (" << count << " elements, " << components << " components): bounds[" << c << "] "
+                                  << actual_min[c] << ".." << actual_max[c] << ", expected " << expected_min[c] << ".." << expected_max[c] << std::endl;
+                        success = false;
+                    }
+                }
+                ++cases;
+            }
+        }
+    }
+
+    std::cout << "[CHECK] " << name << ": " << cases << " cases" << (success ? "" : " FAILED") << std::endl;
+    return success;
+}
+
+// Runs every SIMD kernel the CPU supports, regardless of --simd. Returns false on the first mismatch.
+static bool simd_check_kernels()
+{
+    std::mt19937 random(20211);
+    bool success = true;
+#if defined(GLTF_SIMD_X86)
+    const gltf_simd_level detected = gltf_detect_simd_level();
+    std::cout << "[CHECK] detected " << gltf_simd_level_name(detected) << ", epsilon " << simd_check_epsilon << std::endl;
+    if (detected >= gltf_simd_level::sse2) {
+        success = simd_check_skin_kernel("gltf_skin_kernel_sse2", &gltf_skin_kernel_sse2, random) && success;
+        success = simd_check_bounds_kernel("gltf_bounds_kernel_sse2", &gltf_bounds_kernel_sse2, random) && success;
+    }
+    if (detected >= gltf_simd_level::avx2) {
+        success = simd_check_skin_kernel("gltf_skin_kernel_avx2", &gltf_skin_kernel_avx2, random) && success;
+    }
+#else
+    std::cout << "[CHECK] no SIMD kernels on this platform" << std::endl;
+#endif
+    return success;
+}
@@ -0,0 +1,96 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// x86 SIMD kernels are compiled with per-function target attributes and selected at runtime,
+// so the rest of the build does not need any -mavx2 / -msse2 flags (32-bit x86 may not have SSE2).
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GLTF_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GLTF_TARGET_SSE2
+#define GLTF_TARGET_AVX2
+#else
+#define GLTF_TARGET_SSE2 __attribute__((target("sse2")))
+#define GLTF_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+enum class gltf_simd_level {
+    scalar,
+    sse2,
+    avx2
+};
+
+static const char* gltf_simd_level_name(gltf_simd_level level)
+{
+    switch (level) {
+    case gltf_simd_level::avx2:
+        return "avx2";
+    case gltf_simd_level::sse2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+static gltf_simd_level gltf_detect_simd_level()
+{
+#if defined(GLTF_SIMD_X86)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    const bool sse2 = (info[3] & (1 << 26)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    bool avx2 = false;
+    if (max_leaf >= 7 && osxsave && fma && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2)
+        return gltf_simd_level::avx2;
+    if (sse2)
+        return gltf_simd_level::sse2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return gltf_simd_level::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return gltf_simd_level::sse2;
+#endif
+#endif
+    return gltf_simd_level::scalar;
+}
+
+// SIMD level used by kernels, scalar unless enabled with --simd
+static gltf_simd_level gltf_get_simd_level()
+{
+    static const gltf_simd_level detected = gltf_detect_simd_level();
+    return pipeline_simd_enabled ? detected : gltf_simd_level::scalar;
+}
@@ -0,0 +1,600 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <vector>
+
+// Joint matrices of a skin, computed once per skinned primitive instead of once per vertex.
+struct gltf_skin_palette {
+    glm::mat4 global_transform;             // world transform of the skinned node
+    std::vector<glm::mat4> joint_matrices;  // inverse(global) * joint world * inverse bind matrix
+    std::vector<glm::mat4> skin_matrices;   // global * joint matrix, for vertices bound to a single joint
+    std::vector<glm::mat3> normal_matrices; // transpose(inverse(skin matrix)), for vertices bound to a single joint
+};
+
+// skin and normal matrices of joint i from its joint matrix
+static void gltf_update_skin_palette_joint(gltf_skin_palette* palette, cgltf_size i)
+{
+    // same operations as blending a single influence of weight 1 so results stay identical
+    glm::mat4 skinMat = glm::mat4(0.f);
+    skinMat += palette->joint_matrices[i] * 1.f;
+
+    palette->skin_matrices[i] = palette->global_transform * skinMat;
+    palette->normal_matrices[i] = glm::transpose(glm::inverse(glm::mat3(palette->skin_matrices[i])));
+}
+
+static bool gltf_build_skin_palette(const cgltf_node* skin_node, gltf_skin_palette* palette, gltf_world_cache& world, const cgltf_data* data)
+{
+    const cgltf_skin* skin = skin_node->skin;
+    if (skin == nullptr || skin->inverse_bind_matrices == nullptr)
+        return false;
+
+    const cgltf_accessor* accessor = skin->inverse_bind_matrices;
+    const uint8_t* ibm_data = gltf_buffer_view_data(accessor->buffer_view) + accessor->offset;
+
+    palette->global_transform = gltf_get_world_transform(world, skin_node, data);
+    const glm::mat4 globalInverseTransform = glm::inverse(palette->global_transform);
+
+    palette->joint_matrices.resize(skin->joints_count);
+    palette->skin_matrices.resize(skin->joints_count);
+    palette->normal_matrices.resize(skin->joints_count);
+
+    for (cgltf_size i = 0; i < skin->joints_count; ++i) {
+        const cgltf_float* ibm_mat = (const cgltf_float*)(ibm_data + accessor->stride * i);
+
+        const glm::mat4& globalTransformOfJointNode = gltf_get_world_transform(world, skin->joints[i], data);
+        glm::mat4 inverseBindMatrixForJoint = glm::make_mat4(ibm_mat);
+        glm::mat4 jointMatrix = globalTransformOfJointNode * inverseBindMatrixForJoint;
+        jointMatrix = globalInverseTransform * jointMatrix;
+
+        palette->joint_matrices[i] = jointMatrix;
+        gltf_update_skin_palette_joint(palette, i);
+    }
+
+    return true;
+}
+
+// skinning resets rotation and scale of the skinned node, returns true when it actually changed
+static bool gltf_reset_skin_node(cgltf_node* skin_node, gltf_world_cache& world, const cgltf_data* data)
+{
+    const bool changed = skin_node->scale[0] != 1 || skin_node->scale[1] != 1 || skin_node->scale[2] != 1
+        || skin_node->rotation[0] != 0 || skin_node->rotation[1] != 0 || skin_node->rotation[2] != 0 || skin_node->rotation[3] != 1;
+
+    skin_node->scale[0] = 1;
+    skin_node->scale[1] = 1;
+    skin_node->scale[2] = 1;
+
+    skin_node->rotation[0] = 0;
+    skin_node->rotation[1] = 0;
+    skin_node->rotation[2] = 0;
+    skin_node->rotation[3] = 1;
+
+    if (changed)
+        gltf_world_mark_dirty(world, skin_node, data);
+
+    return changed;
+}
+
+// Vertex streams of a skinned primitive. Attribute pointers are strided and may be nullptr,
+// joints and weights are unpacked to 4 values per vertex.
+struct gltf_skin_stream {
+    uint8_t* positions;
+    cgltf_size positions_stride;
+    uint8_t* normals;
+    cgltf_size normals_stride;
+    uint8_t* tangents;
+    cgltf_size tangents_stride;
+    const cgltf_uint* joints;
+    const cgltf_float* weights;
+};
+
+// Skins vertices [begin, end) of the stream, bounds of positions are updated later (see gltf_update_bounds)
+typedef void (*gltf_skin_kernel)(const gltf_skin_palette& palette, const gltf_skin_stream& stream, cgltf_size begin, cgltf_size end);
+
+static void gltf_apply_weight(const gltf_skin_palette& palette, cgltf_float* positions, const cgltf_uint* joints, const cgltf_float* weights, cgltf_float* normals, cgltf_float* tangents)
+{
+    const cgltf_size joints_count = palette.joint_matrices.size();
+
+    cgltf_size influence_count = 0;
+    cgltf_size influence_joint = 0;
+    cgltf_float influence_weight = 0;
+
+    for (cgltf_size i = 0; i < 4; ++i) {
+        if (weights[i] <= 0 || joints_count <= joints[i])
+            continue;
+
+        influence_joint = joints[i];
+        influence_weight = weights[i];
+        ++influence_count;
+    }
+
+    glm::mat4 skinMat;
+    const glm::mat4* locMat = nullptr;
+    const glm::mat3* normalMat = nullptr;
+
+    if (influence_count == 1 && influence_weight == 1.f) {
+        locMat = &palette.skin_matrices[influence_joint];
+        normalMat = &palette.normal_matrices[influence_joint];
+    } else {
+        skinMat = glm::mat4(0.f);
+        for (cgltf_size i = 0; i < 4; ++i) {
+            const cgltf_uint joint_index = joints[i];
+            cgltf_float weight = weights[i];
+
+            if (weight <= 0)
+                continue;
+
+            if (joints_count <= joint_index)
+                continue;
+
+            skinMat += palette.joint_matrices[joint_index] * weight;
+        }
+        skinMat = palette.global_transform * skinMat;
+        locMat = &skinMat;
+    }
+
+    glm::vec4 inPos = glm::vec4(positions[0], positions[1], positions[2], 1.f);
+    glm::vec4 locPos = *locMat * inPos;
+
+    positions[0] = locPos.x;
+    positions[1] = locPos.y;
+    positions[2] = locPos.z;
+
+    if (normals != nullptr) {
+        glm::vec3 inNormal = glm::make_vec3(normals);
+        glm::vec3 outNormal;
+        if (normalMat != nullptr) {
+            outNormal = glm::normalize(*normalMat * inNormal);
+        } else {
+            outNormal = glm::normalize(glm::transpose(glm::inverse(glm::mat3(*locMat))) * inNormal);
+        }
+
+        normals[0] = outNormal.x;
+        normals[1] = outNormal.y;
+        normals[2] = outNormal.z;
+    }
+
+    // tangent.w (handedness) is kept as is
+    if (tangents != nullptr) {
+        glm::vec3 inTangent = glm::make_vec3(tangents);
+        glm::vec3 outTangent = glm::normalize(glm::mat3(*locMat) * inTangent);
+
+        tangents[0] = outTangent.x;
+        tangents[1] = outTangent.y;
+        tangents[2] = outTangent.z;
+    }
+}
+
+// reference implementation, other kernels are compared against this one
+static void gltf_skin_kernel_scalar(const gltf_skin_palette& palette, const gltf_skin_stream& stream, cgltf_size begin, cgltf_size end)
+{
+    for (cgltf_size i = begin; i < end; ++i) {
+        cgltf_float* position = (cgltf_float*)(stream.positions + (stream.positions_stride * i));
+        cgltf_float* normal = stream.normals != nullptr ? (cgltf_float*)(stream.normals + (stream.normals_stride * i)) : nullptr;
+        cgltf_float* tangent = stream.tangents != nullptr ? (cgltf_float*)(stream.tangents + (stream.tangents_stride * i)) : nullptr;
+
+        gltf_apply_weight(palette, position, stream.joints + (i * 4), stream.weights + (i * 4), normal, tangent);
+    }
+}
+
+#if defined(GLTF_SIMD_X86)
+
+// SSE2: blends the 4 joint matrices of each vertex column by column, then transposes
+// 4 vertices into structure-of-arrays form and transforms them together.
+GLTF_TARGET_SSE2 static inline __m128 gltf_sse2_load_lanes(const uint8_t* base, cgltf_size stride, cgltf_size i, cgltf_size component)
+{
+    return _mm_set_ps(((const cgltf_float*)(base + stride * (i + 3)))[component], ((const cgltf_float*)(base + stride * (i + 2)))[component],
+        ((const cgltf_float*)(base + stride * (i + 1)))[component], ((const cgltf_float*)(base + stride * i))[component]);
+}
+
+GLTF_TARGET_SSE2 static inline void gltf_sse2_store_lanes(uint8_t* base, cgltf_size stride, cgltf_size i, cgltf_size component, __m128 value)
+{
+    alignas(16) cgltf_float lanes[4];
+    _mm_store_ps(lanes, value);
+    for (cgltf_size lane = 0; lane < 4; ++lane) {
+        ((cgltf_float*)(base + stride * (i + lane)))[component] = lanes[lane];
+    }
+}
+
+GLTF_TARGET_SSE2 static inline void gltf_sse2_normalize(__m128& x, __m128& y, __m128& z)
+{
+    const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+    x = _mm_div_ps(x, length);
+    y = _mm_div_ps(y, length);
+    z = _mm_div_ps(z, length);
+}
+
+GLTF_TARGET_SSE2 static void gltf_skin_kernel_sse2(const gltf_skin_palette& palette, const gltf_skin_stream& stream, cgltf_size begin, cgltf_size end)
+{
+    const cgltf_size joints_count = palette.skin_matrices.size();
+    if (joints_count == 0) {
+        gltf_skin_kernel_scalar(palette, stream, begin, end);
+        return;
+    }
+
+    const cgltf_float* matrices = glm::value_ptr(palette.skin_matrices[0]);
+    const __m128 sign_mask = _mm_set1_ps(-0.f);
+
+    cgltf_size i = begin;
+    for (; i + 4 <= end; i += 4) {
+        // m[column][lane] -> m[column][row] after transpose
+        __m128 m[4][4];
+        for (cgltf_size lane = 0; lane < 4; ++lane) {
+            const cgltf_uint* joints = stream.joints + (i + lane) * 4;
+            const cgltf_float* weights = stream.weights + (i + lane) * 4;
+
+            __m128 c0 = _mm_setzero_ps();
+            __m128 c1 = _mm_setzero_ps();
+            __m128 c2 = _mm_setzero_ps();
+            __m128 c3 = _mm_setzero_ps();
+            for (cgltf_size k = 0; k < 4; ++k) {
+                if (weights[k] <= 0 || joints_count <= joints[k])
+                    continue;
+
+                const cgltf_float* mat = matrices + joints[k] * 16;
+                const __m128 w = _mm_set1_ps(weights[k]);
+                c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(mat), w));
+                c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(mat + 4), w));
+                c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(mat + 8), w));
+                c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(mat + 12), w));
+            }
+            m[0][lane] = c0;
+            m[1][lane] = c1;
+            m[2][lane] = c2;
+            m[3][lane] = c3;
+        }
+        for (cgltf_size c = 0; c < 4; ++c) {
+            _MM_TRANSPOSE4_PS(m[c][0], m[c][1], m[c][2], m[c][3]);
+        }
+
+        const __m128 px = gltf_sse2_load_lanes(stream.positions, stream.positions_stride, i, 0);
+        const __m128 py = gltf_sse2_load_lanes(stream.positions, stream.positions_stride, i, 1);
+        const __m128 pz = gltf_sse2_load_lanes(stream.positions, stream.positions_stride, i, 2);
+
+        for (cgltf_size r = 0; r < 3; ++r) {
+            const __m128 out = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][r], px), _mm_mul_ps(m[1][r], py)), _mm_add_ps(_mm_mul_ps(m[2][r], pz), m[3][r]));
+            gltf_sse2_store_lanes(stream.positions, stream.positions_stride, i, r, out);
+        }
+
+        if (stream.normals != nullptr) {
+            // inverse transpose is cofactor / determinant, the determinant only matters for its sign after normalize
+            const __m128 c12x = _mm_sub_ps(_mm_mul_ps(m[1][1], m[2][2]), _mm_mul_ps(m[1][2], m[2][1]));
+            const __m128 c12y = _mm_sub_ps(_mm_mul_ps(m[1][2], m[2][0]), _mm_mul_ps(m[1][0], m[2][2]));
+            const __m128 c12z = _mm_sub_ps(_mm_mul_ps(m[1][0], m[2][1]), _mm_mul_ps(m[1][1], m[2][0]));
+            const __m128 c20x = _mm_sub_ps(_mm_mul_ps(m[2][1], m[0][2]), _mm_mul_ps(m[2][2], m[0][1]));
+            const __m128 c20y = _mm_sub_ps(_mm_mul_ps(m[2][2], m[0][0]), _mm_mul_ps(m[2][0], m[0][2]));
+            const __m128 c20z = _mm_sub_ps(_mm_mul_ps(m[2][0], m[0][1]), _mm_mul_ps(m[2][1], m[0][0]));
+            const __m128 c01x = _mm_sub_ps(_mm_mul_ps(m[0][1], m[1][2]), _mm_mul_ps(m[0][2], m[1][1]));
+            const __m128 c01y = _mm_sub_ps(_mm_mul_ps(m[0][2], m[1][0]), _mm_mul_ps(m[0][0], m[1][2]));
+            const __m128 c01z = _mm_sub_ps(_mm_mul_ps(m[0][0], m[1][1]), _mm_mul_ps(m[0][1], m[1][0]));
+            const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], c12x), _mm_mul_ps(m[0][1], c12y)), _mm_mul_ps(m[0][2], c12z));
+            const __m128 det_sign = _mm_and_ps(det, sign_mask);
+
+            const __m128 nx = gltf_sse2_load_lanes(stream.normals, stream.normals_stride, i, 0);
+            const __m128 ny = gltf_sse2_load_lanes(stream.normals, stream.normals_stride, i, 1);
+            const __m128 nz = gltf_sse2_load_lanes(stream.normals, stream.normals_stride, i, 2);
+
+            __m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c12x, nx), _mm_mul_ps(c20x, ny)), _mm_mul_ps(c01x, nz));
+            __m128 oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c12y, nx), _mm_mul_ps(c20y, ny)), _mm_mul_ps(c01y, nz));
+            __m128 oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c12z, nx), _mm_mul_ps(c20z, ny)), _mm_mul_ps(c01z, nz));
+            gltf_sse2_normalize(ox, oy, oz);
+
+            gltf_sse2_store_lanes(stream.normals, stream.normals_stride, i, 0, _mm_xor_ps(ox, det_sign));
+            gltf_sse2_store_lanes(stream.normals, stream.normals_stride, i, 1, _mm_xor_ps(oy, det_sign));
+            gltf_sse2_store_lanes(stream.normals, stream.normals_stride, i, 2, _mm_xor_ps(oz, det_sign));
+        }
+
+        if (stream.tangents != nullptr) {
+            const __m128 tx = gltf_sse2_load_lanes(stream.tangents, stream.tangents_stride, i, 0);
+            const __m128 ty = gltf_sse2_load_lanes(stream.tangents, stream.tangents_stride, i, 1);
+            const __m128 tz = gltf_sse2_load_lanes(stream.tangents, stream.tangents_stride, i, 2);
+
+            __m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], tx), _mm_mul_ps(m[1][0], ty)), _mm_mul_ps(m[2][0], tz));
+            __m128 oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][1], tx), _mm_mul_ps(m[1][1], ty)), _mm_mul_ps(m[2][1], tz));
+            __m128 oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][2], tx), _mm_mul_ps(m[1][2], ty)), _mm_mul_ps(m[2][2], tz));
+            gltf_sse2_normalize(ox, oy, oz);
+
+            gltf_sse2_store_lanes(stream.tangents, stream.tangents_stride, i, 0, ox);
+            gltf_sse2_store_lanes(stream.tangents, stream.tangents_stride, i, 1, oy);
+            gltf_sse2_store_lanes(stream.tangents, stream.tangents_stride, i, 2, oz);
+        }
+    }
+
+    gltf_skin_kernel_scalar(palette, stream, i, end);
+}
+
+// AVX2: 8 vertices per iteration, joint matrices are gathered straight into structure-of-arrays form
+GLTF_TARGET_AVX2 static inline __m256 gltf_avx2_load_lanes(const uint8_t* base, cgltf_size stride, cgltf_size i, cgltf_size component, __m256i offsets)
+{
+    return _mm256_i32gather_ps((const float*)(base + stride * i) + component, offsets, 1);
+}
+
+GLTF_TARGET_AVX2 static inline void gltf_avx2_store_lanes(uint8_t* base, cgltf_size stride, cgltf_size i, cgltf_size component, __m256 value)
+{
+    alignas(32) cgltf_float lanes[8];
+    _mm256_store_ps(lanes, value);
+    for (cgltf_size lane = 0; lane < 8; ++lane) {
+        ((cgltf_float*)(base + stride * (i + lane)))[component] = lanes[lane];
+    }
+}
+
+GLTF_TARGET_AVX2 static inline void gltf_avx2_normalize(__m256& x, __m256& y, __m256& z)
+{
+    const __m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z))));
+    x = _mm256_div_ps(x, length);
+    y = _mm256_div_ps(y, length);
+    z = _mm256_div_ps(z, length);
+}
+
+GLTF_TARGET_AVX2 static inline __m256i gltf_avx2_stride_offsets(cgltf_size stride)
+{
+    const int s = (int)stride;
+    return _mm256_setr_epi32(0, s, s * 2, s * 3, s * 4, s * 5, s * 6, s * 7);
+}
+
+GLTF_TARGET_AVX2 static void gltf_skin_kernel_avx2(const gltf_skin_palette& palette, const gltf_skin_stream& stream, cgltf_size begin, cgltf_size end)
+{
+    const cgltf_size joints_count = palette.skin_matrices.size();
+    if (joints_count == 0 || joints_count > 0x7ffffff) {
+        gltf_skin_kernel_scalar(palette, stream, begin, end);
+        return;
+    }
+
+    const cgltf_float* matrices = glm::value_ptr(palette.skin_matrices[0]);
+    const __m256 sign_mask = _mm256_set1_ps(-0.f);
+    const __m256i joints_limit = _mm256_set1_epi32((int)joints_count);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+
+    const __m256i position_offsets = gltf_avx2_stride_offsets(stream.positions_stride);
+    const __m256i normal_offsets = gltf_avx2_stride_offsets(stream.normals_stride);
+    const __m256i tangent_offsets = gltf_avx2_stride_offsets(stream.tangents_stride);
+
+    cgltf_size i = begin;
+    for (; i + 8 <= end; i += 8) {
+        // m[column][row], rows 0..2 of the blended matrix for 8 vertices
+        __m256 m[4][3];
+        for (cgltf_size c = 0; c < 4; ++c) {
+            for (cgltf_size r = 0; r < 3; ++r) {
+                m[c][r] = _mm256_setzero_ps();
+            }
+        }
+
+        for (int k = 0; k < 4; ++k) {
+            const __m256i influence = _mm256_setr_epi32(k, 4 + k, 8 + k, 12 + k, 16 + k, 20 + k, 24 + k, 28 + k);
+            __m256i joints = _mm256_i32gather_epi32((const int*)(stream.joints + i * 4), influence, 4);
+            __m256 weights = _mm256_i32gather_ps(stream.weights + i * 4, influence, 4);
+
+            // drop influences with weight <= 0 or out of range joint, same as the scalar path
+            const __m256i valid_joint = _mm256_and_si256(_mm256_cmpgt_epi32(joints, minus_one), _mm256_cmpgt_epi32(joints_limit, joints));
+            const __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(valid_joint), _mm256_cmp_ps(weights, _mm256_setzero_ps(), _CMP_GT_OQ));
+            weights = _mm256_and_ps(weights, valid);
+            joints = _mm256_and_si256(joints, _mm256_castps_si256(valid));
+
+            const __m256i index = _mm256_slli_epi32(joints, 4);
+            for (int c = 0; c < 4; ++c) {
+                for (int r = 0; r < 3; ++r) {
+                    const __m256 entry = _mm256_i32gather_ps(matrices + c * 4 + r, index, 4);
+                    m[c][r] = _mm256_fmadd_ps(entry, weights, m[c][r]);
+                }
+            }
+        }
+
+        const __m256 px = gltf_avx2_load_lanes(stream.positions, stream.positions_stride, i, 0, position_offsets);
+        const __m256 py = gltf_avx2_load_lanes(stream.positions, stream.positions_stride, i, 1, position_offsets);
+        const __m256 pz = gltf_avx2_load_lanes(stream.positions, stream.positions_stride, i, 2, position_offsets);
+
+        for (cgltf_size r = 0; r < 3; ++r) {
+            const __m256 out = _mm256_fmadd_ps(m[0][r], px, _mm256_fmadd_ps(m[1][r], py, _mm256_fmadd_ps(m[2][r], pz, m[3][r])));
+            gltf_avx2_store_lanes(stream.positions, stream.positions_stride, i, r, out);
+        }
+
+        if (stream.normals != nullptr) {
+            // inverse transpose is cofactor / determinant, the determinant only matters for its sign after normalize
+            const __m256 c12x = _mm256_fmsub_ps(m[1][1], m[2][2], _mm256_mul_ps(m[1][2], m[2][1]));
+            const __m256 c12y = _mm256_fmsub_ps(m[1][2], m[2][0], _mm256_mul_ps(m[1][0], m[2][2]));
+            const __m256 c12z = _mm256_fmsub_ps(m[1][0], m[2][1], _mm256_mul_ps(m[1][1], m[2][0]));
+            const __m256 c20x = _mm256_fmsub_ps(m[2][1], m[0][2], _mm256_mul_ps(m[2][2], m[0][1]));
+            const __m256 c20y = _mm256_fmsub_ps(m[2][2], m[0][0], _mm256_mul_ps(m[2][0], m[0][2]));
+            const __m256 c20z = _mm256_fmsub_ps(m[2][0], m[0][1], _mm256_mul_ps(m[2][1], m[0][0]));
+            const __m256 c01x = _mm256_fmsub_ps(m[0][1], m[1][2], _mm256_mul_ps(m[0][2], m[1][1]));
+            const __m256 c01y = _mm256_fmsub_ps(m[0][2], m[1][0], _mm256_mul_ps(m[0][0], m[1][2]));
+            const __m256 c01z = _mm256_fmsub_ps(m[0][0], m[1][1], _mm256_mul_ps(m[0][1], m[1][0]));
+            const __m256 det = _mm256_fmadd_ps(m[0][0], c12x, _mm256_fmadd_ps(m[0][1], c12y, _mm256_mul_ps(m[0][2], c12z)));
+            const __m256 det_sign = _mm256_and_ps(det, sign_mask);
+
+            const __m256 nx = gltf_avx2_load_lanes(stream.normals, stream.normals_stride, i, 0, normal_offsets);
+            const __m256 ny = gltf_avx2_load_lanes(stream.normals, stream.normals_stride, i, 1, normal_offsets);
+            const __m256 nz = gltf_avx2_load_lanes(stream.normals, stream.normals_stride, i, 2, normal_offsets);
+
+            __m256 ox = _mm256_fmadd_ps(c12x, nx, _mm256_fmadd_ps(c20x, ny, _mm256_mul_ps(c01x, nz)));
+            __m256 oy = _mm256_fmadd_ps(c12y, nx, _mm256_fmadd_ps(c20y, ny, _mm256_mul_ps(c01y, nz)));
+            __m256 oz = _mm256_fmadd_ps(c12z, nx, _mm256_fmadd_ps(c20z, ny, _mm256_mul_ps(c01z, nz)));
+            gltf_avx2_normalize(ox, oy, oz);
+
+            gltf_avx2_store_lanes(stream.normals, stream.normals_stride, i, 0, _mm256_xor_ps(ox, det_sign));
+            gltf_avx2_store_lanes(stream.normals, stream.normals_stride, i, 1, _mm256_xor_ps(oy, det_sign));
+            gltf_avx2_store_lanes(stream.normals, stream.normals_stride, i, 2, _mm256_xor_ps(oz, det_sign));
+        }
+
+        if (stream.tangents != nullptr) {
+            const __m256 tx = gltf_avx2_load_lanes(stream.tangents, stream.tangents_stride, i, 0, tangent_offsets);
+            const __m256 ty = gltf_avx2_load_lanes(stream.tangents, stream.tangents_stride, i, 1, tangent_offsets);
+            const __m256 tz = gltf_avx2_load_lanes(stream.tangents, stream.tangents_stride, i, 2, tangent_offsets);
+
+            __m256 ox = _mm256_fmadd_ps(m[0][0], tx, _mm256_fmadd_ps(m[1][0], ty, _mm256_mul_ps(m[2][0], tz)));
+            __m256 oy = _mm256_fmadd_ps(m[0][1], tx, _mm256_fmadd_ps(m[1][1], ty, _mm256_mul_ps(m[2][1], tz)));
+            __m256 oz = _mm256_fmadd_ps(m[0][2], tx, _mm256_fmadd_ps(m[1][2], ty, _mm256_mul_ps(m[2][2], tz)));
+            gltf_avx2_normalize(ox, oy, oz);
+
+            gltf_avx2_store_lanes(stream.tangents, stream.tangents_stride, i, 0, ox);
+            gltf_avx2_store_lanes(stream.tangents, stream.tangents_stride, i, 1, oy);
+            gltf_avx2_store_lanes(stream.tangents, stream.tangents_stride, i, 2, oz);
+        }
+    }
+
+    gltf_skin_kernel_scalar(palette, stream, i, end);
+}
+
+#endif
+
+static gltf_skin_kernel gltf_select_skin_kernel()
+{
+#if defined(GLTF_SIMD_X86)
+    switch (gltf_get_simd_level()) {
+    case gltf_simd_level::avx2:
+        return &gltf_skin_kernel_avx2;
+    case gltf_simd_level::sse2:
+        return &gltf_skin_kernel_sse2;
+    default:
+        break;
+    }
+#endif
+    return &gltf_skin_kernel_scalar;
+}
+
+static uint8_t* gltf_accessor_data(cgltf_data* data, cgltf_accessor* accessor)
+{
+    if (accessor == nullptr)
+        return nullptr;
+    return gltf_accessor_write_data(data, accessor);
+}
+
+// Skinning of one primitive. The first vertex is skinned when the job is prepared,
+// the remaining vertices are skinned on the thread pool by gltf_run_skin_jobs.
+struct gltf_skin_job {
+    cgltf_accessor* positions;
+    gltf_skin_palette palette;
+    gltf_skin_stream stream;
+};
+
+static bool gltf_prepare_skin_job(gltf_mesh_index& index, cgltf_node* skin_node, cgltf_accessor* positions, cgltf_accessor* joints, cgltf_accessor* weights, cgltf_accessor* normals, cgltf_accessor* tangents, gltf_skin_job* job)
+{
+    if (!gltf_build_skin_palette(skin_node, &job->palette, index.world, index.data)) {
+        AVATAR_PIPELINE_LOG("[WARN] skinning skipped: no skin or inverse bind matrices found for node " << (skin_node->name ? skin_node->name : ""));
+        return false;
+    }
+
+    cgltf_uint* joints_data = (cgltf_uint*)gltf_calloc(joints->count * 4, sizeof(cgltf_uint));
+    for (cgltf_size i = 0; i < joints->count; ++i) {
+        cgltf_accessor_read_uint(joints, i, joints_data + (i * 4), 4);
+    }
+
+    cgltf_size unpack_count = weights->count * 4;
+    cgltf_float* weights_data = (cgltf_float*)gltf_calloc(unpack_count, sizeof(cgltf_float));
+    cgltf_accessor_unpack_floats(weights, weights_data, unpack_count);
+
+    job->positions = positions;
+    job->stream = {};
+    job->stream.positions = gltf_accessor_data(index.data, positions);
+    job->stream.positions_stride = positions->stride;
+    job->stream.normals = gltf_accessor_data(index.data, normals);
+    job->stream.normals_stride = normals != nullptr ? normals->stride : 0;
+    job->stream.tangents = gltf_accessor_data(index.data, tangents);
+    job->stream.tangents_stride = tangents != nullptr ? tangents->stride : 0;
+    job->stream.joints = joints_data;
+    job->stream.weights = weights_data;
+
+    if (positions->count > 0) {
+        // the first vertex is skinned with the original node transform, the rest without rotation and scale
+        gltf_skin_kernel_scalar(job->palette, job->stream, 0, 1);
+        if (gltf_reset_skin_node(skin_node, index.world, index.data)) {
+            gltf_build_skin_palette(skin_node, &job->palette, index.world, index.data);
+        }
+    }
+
+    return true;
+}
+
+static void gltf_run_skin_jobs(std::vector<gltf_skin_job>& jobs)
+{
+    std::vector<cgltf_size> counts;
+    for (const auto& job : jobs) {
+        counts.push_back(job.positions->count > 0 ? job.positions->count - 1 : 0);
+    }
+
+    const auto ranges = gltf_parallel_split(counts);
+    const gltf_skin_kernel kernel = gltf_select_skin_kernel();
+    gltf_parallel_for(ranges, [&](cgltf_size, const gltf_parallel_range& range) {
+        const auto& job = jobs[range.item];
+        kernel(job.palette, job.stream, range.begin + 1, range.end + 1);
+    });
+
+    for (auto& job : jobs) {
+        gltf_free((void*)job.stream.joints);
+        gltf_free((void*)job.stream.weights);
+    }
+    jobs.clear();
+}
+
+static bool gltf_skinning(cgltf_data* data, gltf_mesh_index& index)
+{
+    AVATAR_PIPELINE_LOG("[INFO] skinning kernel: " << gltf_simd_level_name(gltf_get_simd_level()) << ", threads: " << gltf_get_thread_pool()->size());
+
+    std::vector<gltf_skin_job> jobs;
+    std::vector<uint8_t> jobs_accessors(data->accessors_count, 0);
+
+    // vertex data is skinned only once, other nodes using it only need their rotation and scale reset.
+    // Resets happen at their place in node order, later palettes may depend on them.
+    cgltf_size shared = 0;
+    const auto reset_shared_nodes = [&](cgltf_size order) {
+        for (; shared < index.skinned_shared_nodes.size() && index.skinned_shared_order[shared] <= order; ++shared) {
+            const auto node = &data->nodes[index.skinned_shared_nodes[shared]];
+            if (node->skin != nullptr)
+                gltf_reset_skin_node(node, index.world, data);
+        }
+    };
+
+    for (cgltf_size p = 0; p < index.skinned_primitives.size(); ++p) {
+        const auto& primitive = index.skinned_primitives[p];
+        const auto node = &data->nodes[primitive.node];
+
+        reset_shared_nodes(p);
+
+        // primitives sharing vertex data are skinned one after another, same as sequential skinning
+        if (jobs_accessors[primitive.position] || (primitive.normal != gltf_mesh_index_none && jobs_accessors[primitive.normal]) || (primitive.tangent != gltf_mesh_index_none && jobs_accessors[primitive.tangent])) {
+            gltf_run_skin_jobs(jobs);
+            std::fill(jobs_accessors.begin(), jobs_accessors.end(), 0);
+        }
+
+        const auto acc_POSITION = gltf_mesh_index_get_accessor(index, primitive.position);
+        const auto acc_NORMAL = gltf_mesh_index_get_accessor(index, primitive.normal);
+        const auto acc_TANGENT = gltf_mesh_index_get_accessor(index, primitive.tangent);
+
+        gltf_skin_job job;
+        if (gltf_prepare_skin_job(index, node, acc_POSITION, gltf_mesh_index_get_accessor(index, primitive.joints), gltf_mesh_index_get_accessor(index, primitive.weights), acc_NORMAL, acc_TANGENT, &job)) {
+            jobs.push_back(job);
+            jobs_accessors[primitive.position] = 1;
+            gltf_mesh_index_mark_dirty(index, acc_POSITION);
+            if (acc_NORMAL != nullptr) {
+                jobs_accessors[primitive.normal] = 1;
+                gltf_mesh_index_mark_dirty(index, acc_NORMAL);
+            }
+            if (acc_TANGENT != nullptr) {
+                jobs_accessors[primitive.tangent] = 1;
+                gltf_mesh_index_mark_dirty(index, acc_TANGENT);
+            }
+        }
+    }
+    gltf_run_skin_jobs(jobs);
+    reset_shared_nodes(index.skinned_primitives.size());
+
+    return true;
+}
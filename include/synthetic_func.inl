@@ -0,0 +1,368 @@
+/* distributed under MIT license:
+ * 
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_SILENT_WARNINGS
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Synthetic avatar generator for scaling tests: humanoid skeleton named after "bones" of an input
+// config (input.mixamo.json, input.readyplayerme.json), skinned cylinders along the bones in A-pose.
+struct synthetic_avatar_params {
+    size_t vertices = 10000;       // total, split across primitives
+    size_t primitives = 1;
+    size_t bone_depth = 0;         // extra joint chain under Head, deepens the hierarchy
+    size_t morph_targets = 0;      // per primitive, POSITION deltas
+    size_t textures = 1;
+    size_t texture_size = 256;
+    bool texture_jpeg = true;      // jpeg exercises glb_jpeg_to_png
+    float animation_length = 0.f;  // seconds at 30 fps, rotation of every bone
+    bool vrm = false;              // adds VRM 0.0 extension
+};
+
+struct synthetic_bone {
+    std::string vrm_name;
+    int parent;
+    glm::vec3 offset;
+};
+
+// VRM humanoid bones in A-pose, left side is +x
+static std::vector<synthetic_bone> synthetic_humanoid_bones(size_t bone_depth)
+{
+    std::vector<synthetic_bone> bones = {
+        { "Hips", -1, { 0.f, 1.f, 0.f } },
+        { "Spine", 0, { 0.f, 0.1f, 0.f } },
+        { "Chest", 1, { 0.f, 0.12f, 0.f } },
+        { "UpperChest", 2, { 0.f, 0.12f, 0.f } },
+        { "Neck", 3, { 0.f, 0.15f, 0.f } },
+        { "Head", 4, { 0.f, 0.1f, 0.f } },
+    };
+    const int upper_chest = 3;
+
+    const char* fingers[] = { "Thumb", "Index", "Middle", "Ring", "Little" };
+    for (const auto side : { "Left", "Right" }) {
+        const float x = std::string(side) == "Left" ? 1.f : -1.f;
+        const auto add = [&](std::string name, int parent, glm::vec3 offset) {
+            bones.push_back({ side + name, parent, offset * glm::vec3(x, 1.f, 1.f) });
+            return (int)bones.size() - 1;
+        };
+
+        const int shoulder = add("Shoulder", upper_chest, { 0.03f, 0.12f, 0.f });
+        const int upper_arm = add("UpperArm", shoulder, { 0.12f, 0.f, 0.f });
+        const int lower_arm = add("LowerArm", upper_arm, { 0.19f, -0.19f, 0.f });
+        const int hand = add("Hand", lower_arm, { 0.18f, -0.18f, 0.f });
+        for (int i = 0; i < 5; ++i) {
+            const int proximal = add(std::string(fingers[i]) + "Proximal", hand, { 0.05f, -0.05f, 0.03f - 0.015f * i });
+            const int intermediate = add(std::string(fingers[i]) + "Intermediate", proximal, { 0.025f, -0.025f, 0.f });
+            add(std::string(fingers[i]) + "Distal", intermediate, { 0.02f, -0.02f, 0.f });
+        }
+
+        const int upper_leg = add("UpperLeg", 0, { 0.09f, -0.05f, 0.f });
+        const int lower_leg = add("LowerLeg", upper_leg, { 0.f, -0.42f, 0.f });
+        const int foot = add("Foot", lower_leg, { 0.f, -0.42f, 0.f });
+        add("Toes", foot, { 0.f, -0.05f, 0.12f });
+    }
+
+    int parent = 5; // Head
+    for (size_t i = 0; i < bone_depth; ++i) {
+        bones.push_back({ "HairJoint" + std::to_string(i), parent, { 0.f, 0.02f, -0.02f } });
+        parent = (int)bones.size() - 1;
+    }
+
+    return bones;
+}
+
+// Binary chunk and JSON of a GLB under construction
+struct synthetic_glb {
+    nlohmann::json gltf;
+    std::vector<uint8_t> bin;
+
+    size_t add_view(const void* data, size_t size, int target = 0)
+    {
+        bin.resize((bin.size() + 3) & ~(size_t)3);
+        const size_t offset = bin.size();
+        bin.insert(bin.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+
+        nlohmann::json view = { { "buffer", 0 }, { "byteOffset", offset }, { "byteLength", size } };
+        if (target != 0)
+            view["target"] = target;
+        gltf["bufferViews"].push_back(view);
+        return gltf["bufferViews"].size() - 1;
+    }
+
+    template <typename T>
+    size_t add_accessor(const std::vector<T>& values, int component_type, size_t components, const char* type, int target = 0)
+    {
+        nlohmann::json accessor = {
+            { "bufferView", add_view(values.data(), values.size() * sizeof(T), target) },
+            { "componentType", component_type },
+            { "count", values.size() / components },
+            { "type", type }
+        };
+        gltf["accessors"].push_back(accessor);
+        return gltf["accessors"].size() - 1;
+    }
+
+    // POSITION and animation input require bounds
+    size_t add_float_accessor(const std::vector<float>& values, size_t components, const char* type, bool bounds, int target = 0)
+    {
+        const size_t index = add_accessor(values, 5126, components, type, target);
+        if (bounds && !values.empty()) {
+            std::vector<float> min(values.begin(), values.begin() + components);
+            std::vector<float> max = min;
+            for (size_t i = 0; i < values.size(); ++i) {
+                min[i % components] = std::min(min[i % components], values[i]);
+                max[i % components] = std::max(max[i % components], values[i]);
+            }
+            gltf["accessors"][index]["min"] = min;
+            gltf["accessors"][index]["max"] = max;
+        }
+        return index;
+    }
+
+    bool write(std::string output)
+    {
+        gltf["buffers"] = nlohmann::json::array({ { { "byteLength", bin.size() } } });
+
+        std::string json_chunk = gltf.dump();
+        json_chunk.resize((json_chunk.size() + 3) & ~(size_t)3, ' ');
+        bin.resize((bin.size() + 3) & ~(size_t)3, 0);
+
+        const uint32_t json_size = (uint32_t)json_chunk.size();
+        const uint32_t bin_size = (uint32_t)bin.size();
+        const uint32_t total_size = 12 + 8 + json_size + 8 + bin_size;
+        const uint32_t header[] = { 0x46546C67, 2, total_size, json_size, 0x4E4F534A };
+        const uint32_t bin_header[] = { bin_size, 0x004E4942 };
+
+        std::ofstream fout(output, std::ios::out | std::ios::binary | std::ios::trunc);
+        fout.write((const char*)header, sizeof(header));
+        fout.write(json_chunk.data(), json_chunk.size());
+        fout.write((const char*)bin_header, sizeof(bin_header));
+        fout.write((const char*)bin.data(), bin.size());
+        return !fout.fail();
+    }
+};
+
+static void synthetic_image_write_func(void* context, void* data, int size)
+{
+    auto out = (std::vector<uint8_t>*)context;
+    out->insert(out->end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+// bones_config: input config with "bones" (VRM bone name to node name), VRM names are used when missing
+static bool synthetic_avatar_write(const synthetic_avatar_params& params, nlohmann::json bones_config, std::string output)
+{
+    const auto bones = synthetic_humanoid_bones(params.bone_depth);
+    const auto& names = bones_config["bones"];
+
+    synthetic_glb glb;
+    auto& gltf = glb.gltf;
+    gltf["asset"] = { { "version", "2.0" }, { "generator", "avatar-bench synthetic avatar" } };
+
+    // skeleton: bone i is node i, mesh node comes last
+    std::vector<glm::vec3> world(bones.size());
+    for (size_t i = 0; i < bones.size(); ++i) {
+        const auto& bone = bones[i];
+        world[i] = bone.parent < 0 ? bone.offset : world[bone.parent] + bone.offset;
+
+        const bool mapped = names.is_object() && names.contains(bone.vrm_name) && names[bone.vrm_name].is_string();
+        const std::string name = mapped ? names[bone.vrm_name].get<std::string>() : bone.vrm_name;
+        gltf["nodes"].push_back({ { "name", name }, { "translation", { bone.offset.x, bone.offset.y, bone.offset.z } } });
+        if (bone.parent >= 0)
+            gltf["nodes"][bone.parent]["children"].push_back(i);
+    }
+    const size_t mesh_node = bones.size();
+
+    // textures and materials
+    const size_t materials_count = std::max<size_t>(params.textures, 1);
+    const int size = (int)std::max<size_t>(params.texture_size, 1);
+    for (size_t t = 0; t < params.textures; ++t) {
+        std::vector<uint8_t> pixels((size_t)size * size * 3);
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                const bool checker = ((x / 16) + (y / 16)) % 2 == 0;
+                uint8_t* p = &pixels[((size_t)y * size + x) * 3];
+                p[0] = checker ? 255 : (uint8_t)(t * 40);
+                p[1] = checker ? 255 : (uint8_t)(x * 255 / size);
+                p[2] = checker ? 255 : (uint8_t)(y * 255 / size);
+            }
+        }
+        std::vector<uint8_t> encoded;
+        if (params.texture_jpeg)
+            stbi_write_jpg_to_func(synthetic_image_write_func, &encoded, size, size, 3, pixels.data(), 90);
+        else
+            stbi_write_png_to_func(synthetic_image_write_func, &encoded, size, size, 3, pixels.data(), size * 3);
+
+        gltf["images"].push_back({ { "name", "texture" + std::to_string(t) },
+            { "bufferView", glb.add_view(encoded.data(), encoded.size()) },
+            { "mimeType", params.texture_jpeg ? "image/jpeg" : "image/png" } });
+        gltf["textures"].push_back({ { "source", t }, { "sampler", 0 } });
+    }
+    if (params.textures > 0)
+        gltf["samplers"] = nlohmann::json::array({ { { "magFilter", 9729 }, { "minFilter", 9987 } } });
+
+    for (size_t m = 0; m < materials_count; ++m) {
+        nlohmann::json material = { { "name", "material" + std::to_string(m) }, { "pbrMetallicRoughness", { { "metallicFactor", 0.0 } } } };
+        if (params.textures > 0)
+            material["pbrMetallicRoughness"]["baseColorTexture"] = { { "index", m % params.textures } };
+        gltf["materials"].push_back(material);
+    }
+
+    // primitives: cylinder along bone (parent to bone), rings of 16 vertices
+    const size_t ring = 16;
+    const size_t primitives = std::max<size_t>(params.primitives, 1);
+    nlohmann::json mesh = { { "name", "Body" } };
+    for (size_t p = 0; p < primitives; ++p) {
+        const size_t count = params.vertices / primitives + (p == 0 ? params.vertices % primitives : 0);
+        const size_t rings = std::max<size_t>(count / ring, 2);
+        const size_t bone = (p % (bones.size() - 1)) + 1;
+        const size_t parent = (size_t)bones[bone].parent;
+        const glm::vec3 from = world[parent], to = world[bone];
+
+        std::vector<float> positions, normals, texcoords, weights;
+        std::vector<uint8_t> joints8;
+        std::vector<uint16_t> joints16;
+        const bool use_joints8 = bones.size() < 256;
+        for (size_t r = 0; r < rings; ++r) {
+            const float t = (float)r / (rings - 1);
+            const glm::vec3 center = from + (to - from) * t;
+            for (size_t a = 0; a < ring; ++a) {
+                const float angle = 2.f * 3.14159265f * a / ring;
+                const glm::vec3 normal(std::cos(angle), 0.f, std::sin(angle));
+                const glm::vec3 position = center + normal * 0.03f;
+                positions.insert(positions.end(), { position.x, position.y, position.z });
+                normals.insert(normals.end(), { normal.x, normal.y, normal.z });
+                texcoords.insert(texcoords.end(), { (float)a / ring, t });
+                if (use_joints8)
+                    joints8.insert(joints8.end(), { (uint8_t)parent, (uint8_t)bone, 0, 0 });
+                else
+                    joints16.insert(joints16.end(), { (uint16_t)parent, (uint16_t)bone, 0, 0 });
+                weights.insert(weights.end(), { 1.f - t, t, 0.f, 0.f });
+            }
+        }
+
+        std::vector<uint32_t> indices;
+        for (size_t r = 0; r + 1 < rings; ++r) {
+            for (size_t a = 0; a < ring; ++a) {
+                const uint32_t i0 = (uint32_t)(r * ring + a), i1 = (uint32_t)(r * ring + (a + 1) % ring);
+                const uint32_t i2 = i0 + (uint32_t)ring, i3 = i1 + (uint32_t)ring;
+                indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+            }
+        }
+
+        nlohmann::json primitive = { { "material", p % materials_count }, { "mode", 4 } };
+        primitive["attributes"]["POSITION"] = glb.add_float_accessor(positions, 3, "VEC3", true, 34962);
+        primitive["attributes"]["NORMAL"] = glb.add_float_accessor(normals, 3, "VEC3", false, 34962);
+        primitive["attributes"]["TEXCOORD_0"] = glb.add_float_accessor(texcoords, 2, "VEC2", false, 34962);
+        primitive["attributes"]["JOINTS_0"] = use_joints8 ? glb.add_accessor(joints8, 5121, 4, "VEC4", 34962) : glb.add_accessor(joints16, 5123, 4, "VEC4", 34962);
+        primitive["attributes"]["WEIGHTS_0"] = glb.add_float_accessor(weights, 4, "VEC4", false, 34962);
+        if (positions.size() / 3 > 65535) {
+            primitive["indices"] = glb.add_accessor(indices, 5125, 1, "SCALAR", 34963);
+        } else {
+            std::vector<uint16_t> indices16(indices.begin(), indices.end());
+            primitive["indices"] = glb.add_accessor(indices16, 5123, 1, "SCALAR", 34963);
+        }
+
+        for (size_t k = 0; k < params.morph_targets; ++k) {
+            std::vector<float> deltas(normals.size());
+            for (size_t i = 0; i < normals.size(); ++i)
+                deltas[i] = normals[i] * 0.005f * (k + 1);
+            primitive["targets"].push_back({ { "POSITION", glb.add_float_accessor(deltas, 3, "VEC3", true, 34962) } });
+        }
+        mesh["primitives"].push_back(primitive);
+    }
+    if (params.morph_targets > 0)
+        mesh["weights"] = std::vector<float>(params.morph_targets, 0.f);
+    gltf["meshes"].push_back(mesh);
+
+    // skin: bind pose is translation only
+    std::vector<float> inverse_bind_matrices;
+    for (size_t i = 0; i < bones.size(); ++i) {
+        inverse_bind_matrices.insert(inverse_bind_matrices.end(), { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, -world[i].x, -world[i].y, -world[i].z, 1.f });
+        gltf["skins"][0]["joints"].push_back(i);
+    }
+    gltf["skins"][0]["inverseBindMatrices"] = glb.add_float_accessor(inverse_bind_matrices, 16, "MAT4", false);
+    gltf["skins"][0]["skeleton"] = 0;
+
+    gltf["nodes"].push_back({ { "name", "Body" }, { "mesh", 0 }, { "skin", 0 } });
+    gltf["scenes"] = nlohmann::json::array({ { { "nodes", { 0, mesh_node } } } });
+    gltf["scene"] = 0;
+
+    // animation: every bone sways around z
+    if (params.animation_length > 0.f) {
+        const size_t frames = std::max<size_t>((size_t)(params.animation_length * 30.f), 2);
+        std::vector<float> times(frames);
+        for (size_t f = 0; f < frames; ++f)
+            times[f] = f / 30.f;
+        const size_t input = glb.add_float_accessor(times, 1, "SCALAR", true);
+
+        nlohmann::json animation = { { "name", "synthetic" } };
+        for (size_t i = 0; i < bones.size(); ++i) {
+            std::vector<float> rotations;
+            for (size_t f = 0; f < frames; ++f) {
+                const glm::quat q = glm::angleAxis(0.2f * std::sin(times[f] * 2.f + i), glm::vec3(0.f, 0.f, 1.f));
+                rotations.insert(rotations.end(), { q.x, q.y, q.z, q.w });
+            }
+            animation["samplers"].push_back({ { "input", input }, { "output", glb.add_float_accessor(rotations, 4, "VEC4", false) }, { "interpolation", "LINEAR" } });
+            animation["channels"].push_back({ { "sampler", i }, { "target", { { "node", i }, { "path", "rotation" } } } });
+        }
+        gltf["animations"].push_back(animation);
+    }
+
+    if (params.vrm) {
+        nlohmann::json human_bones = nlohmann::json::array();
+        for (size_t i = 0; i < bones.size(); ++i) {
+            if (bones[i].vrm_name.compare(0, 9, "HairJoint") == 0)
+                continue;
+            std::string vrm_bone = bones[i].vrm_name;
+            vrm_bone[0] = (char)std::tolower(vrm_bone[0]);
+            human_bones.push_back({ { "bone", vrm_bone }, { "node", i }, { "useDefaultValues", true } });
+        }
+        nlohmann::json material_properties = nlohmann::json::array();
+        for (size_t m = 0; m < materials_count; ++m)
+            material_properties.push_back({ { "name", "material" + std::to_string(m) }, { "shader", "VRM_USE_GLTFSHADER" } });
+
+        gltf["extensionsUsed"] = { "VRM" };
+        gltf["extensions"]["VRM"] = {
+            { "exporterVersion", "avatar-bench" },
+            { "specVersion", "0.0" },
+            { "meta", { { "title", "synthetic" }, { "version", "1.0" }, { "author", "avatar-bench" }, { "allowedUserName", "Everyone" },
+                          { "violentUssageName", "Disallow" }, { "sexualUssageName", "Disallow" }, { "commercialUssageName", "Allow" }, { "licenseName", "CC0" } } },
+            { "humanoid", { { "humanBones", human_bones } } },
+            { "firstPerson", { { "firstPersonBone", 5 }, { "firstPersonBoneOffset", { { "x", 0 }, { "y", 0.06 }, { "z", 0 } } } } },
+            { "blendShapeMaster", { { "blendShapeGroups", nlohmann::json::array() } } },
+            { "secondaryAnimation", { { "boneGroups", nlohmann::json::array() }, { "colliderGroups", nlohmann::json::array() } } },
+            { "materialProperties", material_properties }
+        };
+    }
+
+    return glb.write(output);
+}
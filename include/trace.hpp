@@ -0,0 +1,231 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace AvatarBuild {
+
+// Collects timed events and writes them in Chrome trace event format,
+// the output loads in chrome://tracing and Perfetto (https://ui.perfetto.dev).
+// Events are kept in memory until flush() appends them to the file, so that a long running
+// server holds only the events of jobs that are not flushed yet.
+class trace_recorder {
+public:
+    explicit trace_recorder(const std::string& file)
+        : start(std::chrono::steady_clock::now())
+        , fout(file, std::ios::out | std::ios::trunc)
+        , named_threads(0)
+        , written_events(0)
+    {
+        threads.emplace(std::this_thread::get_id(), 0); // main thread
+        fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    }
+
+    bool is_open() const
+    {
+        return !fout.fail();
+    }
+
+    uint64_t now_us() const
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // complete event ("ph":"X") on current thread
+    void record(const std::string& name, const char* category, uint64_t begin_us, uint64_t end_us, const nlohmann::json& args)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({
+            { "name", name },
+            { "cat", category },
+            { "ph", "X" },
+            { "ts", begin_us },
+            { "dur", end_us - begin_us },
+            { "pid", 1 },
+            { "tid", thread_index() },
+            { "args", args }
+        });
+    }
+
+    // appends recorded events to the file and drops them from memory
+    bool flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // name threads so that main thread and workers are easy to tell apart
+        for (; named_threads < threads.size(); ++named_threads) {
+            write_event({
+                { "name", "thread_name" },
+                { "ph", "M" },
+                { "pid", 1 },
+                { "tid", named_threads },
+                { "args", { { "name", named_threads == 0 ? "main" : "worker " + std::to_string(named_threads) } } }
+            });
+        }
+        for (const auto& event : events) {
+            write_event(event);
+        }
+        events.clear();
+        fout.flush();
+
+        return !fout.fail();
+    }
+
+    // flushes remaining events and terminates the JSON document
+    bool close()
+    {
+        const bool success = flush();
+        std::lock_guard<std::mutex> lock(mutex);
+        fout << "]}" << std::endl;
+        fout.close();
+        return success && !fout.fail();
+    }
+
+private:
+    // small sequential thread ids in order of first event, 0 is main thread
+    size_t thread_index()
+    {
+        const auto id = std::this_thread::get_id();
+        const auto found = threads.find(id);
+        if (found != threads.end())
+            return found->second;
+        const size_t index = threads.size();
+        threads.emplace(id, index);
+        return index;
+    }
+
+    void write_event(const nlohmann::json& event)
+    {
+        fout << (written_events++ == 0 ? "\n" : ",\n") << event.dump();
+    }
+
+    std::chrono::steady_clock::time_point start;
+    std::ofstream fout;
+    std::mutex mutex;
+    std::vector<nlohmann::json> events;
+    std::unordered_map<std::thread::id, size_t> threads;
+    size_t named_threads; // thread_name events written for indices below
+    size_t written_events;
+};
+
+} // namespace AvatarBuild
+
+static AvatarBuild::trace_recorder* pipeline_trace = nullptr; // nullptr: tracing is disabled
+
+namespace AvatarBuild {
+
+// Records an event from construction to destruction when tracing is enabled, and accounts
+// allocations of the scope when allocation profiler is enabled. Does nothing otherwise.
+class trace_scope {
+public:
+    trace_scope(std::string name, const char* category)
+        : name(name)
+        , category(category)
+        , begin_us(pipeline_trace ? pipeline_trace->now_us() : 0)
+        , alloc(category, name)
+    {
+    }
+
+    ~trace_scope()
+    {
+        if (pipeline_trace) {
+            if (alloc.enabled) {
+                args["allocations"] = alloc.stats.allocations;
+                args["allocated_bytes"] = alloc.stats.bytes;
+                args["peak_bytes"] = std::max<int64_t>(alloc.stats.peak, 0);
+            }
+            pipeline_trace->record(name, category, begin_us, pipeline_trace->now_us(), args);
+        }
+    }
+
+    bool enabled() const
+    {
+        return pipeline_trace != nullptr;
+    }
+
+    void arg(const char* key, uint64_t value)
+    {
+        if (enabled())
+            args[key] = value;
+    }
+
+    void arg(const char* key, const std::string& value)
+    {
+        if (enabled())
+            args[key] = value;
+    }
+
+    // vertex and buffer byte counts of the asset
+    void arg_data(const cgltf_data* data)
+    {
+        if (!enabled() || data == nullptr)
+            return;
+
+        uint64_t vertices = 0;
+        for (cgltf_size i = 0; i < data->meshes_count; ++i) {
+            const auto& mesh = data->meshes[i];
+            for (cgltf_size j = 0; j < mesh.primitives_count; ++j) {
+                const auto& primitive = mesh.primitives[j];
+                for (cgltf_size k = 0; k < primitive.attributes_count; ++k) {
+                    if (primitive.attributes[k].type == cgltf_attribute_type_position && primitive.attributes[k].data != nullptr) {
+                        vertices += primitive.attributes[k].data->count;
+                    }
+                }
+            }
+        }
+        uint64_t bytes = 0;
+        for (cgltf_size i = 0; i < data->buffers_count; ++i) {
+            bytes += data->buffers[i].size;
+        }
+        args["vertices"] = vertices;
+        args["buffer_bytes"] = bytes;
+    }
+
+    // file name as key and its size as key_bytes
+    void arg_file(const std::string& key, const std::string& path)
+    {
+        if (!enabled())
+            return;
+        std::error_code ec;
+        const auto size = fs::file_size(path, ec);
+        args[key] = path;
+        args[key + "_bytes"] = ec ? 0 : (uint64_t)size;
+    }
+
+private:
+    std::string name;
+    const char* category;
+    uint64_t begin_us;
+    nlohmann::json args;
+    alloc_scope alloc;
+};
+
+} // namespace AvatarBuild
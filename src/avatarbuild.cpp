@@ -0,0 +1,181 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string>
+#include <vector>
+
+#include "avatar_build.hpp"
+#include "avatarbuild.h"
+
+struct avatar_build_result {
+    bool success;
+    std::string error;
+    std::vector<std::string> names;
+    std::vector<memory_files::bytes> files;
+};
+
+static bool avatar_build_parse_json(const char* text, const char* what, json* out, std::string* error)
+{
+    if (text == nullptr)
+        return true;
+
+    *out = json::parse(text, nullptr, false);
+    if (out->is_discarded()) {
+        *error = std::string("failed to parse ") + what + " JSON";
+        return false;
+    }
+    return true;
+}
+
+static void avatar_build_run_job(avatar_build_result* result, const uint8_t* input, size_t input_size, const char* pipeline_json,
+    const char* input_config_json, const char* output_config_json, const char* output_name)
+{
+    const std::string output = output_name != nullptr && *output_name != '\0' ? output_name : "output.glb";
+    const std::string source = output != "input.glb" ? "input.glb" : "input.source.glb";
+
+    if (input == nullptr || input_size == 0 || pipeline_json == nullptr) {
+        result->error = "input and pipeline are required";
+        return;
+    }
+
+    json config_json;
+    if (!avatar_build_parse_json(pipeline_json, "pipeline", &config_json, &result->error))
+        return;
+
+    // files are only read for gltfpack LODs
+    cgltf_options gltf_options = {};
+#ifdef WIN32
+    gltf_options.file.read = &gltf_file_read;
+#else
+    gltf_options.file.read = &gltf_file_read;
+    gltf_options.file.release = &gltf_file_release;
+#endif
+
+    // configs don't come from files, textures they refer to are found from working directory
+    const auto config_dir = fs::current_path();
+    cmd_options options = { "", source, output, (config_dir / "input_config.json").u8string(), (config_dir / "output_config.json").u8string(), "", pipeline_verbose_enabled, false, gltf_options };
+    if (!avatar_build_parse_json(input_config_json, "input config", &options.input_config_json, &result->error))
+        return;
+    if (!avatar_build_parse_json(output_config_json, "output config", &options.output_config_json, &result->error))
+        return;
+
+    // cgltf_data of the job points into these, they are released after the job
+    memory_files memory;
+    memory.put(source, std::vector<uint8_t>(input, input + input_size));
+
+    job_context context = { &options, source, output };
+    context.memory = &memory;
+
+    if (!build_and_start_circuits(&context, config_json)) {
+        result->error = "pipeline failed, enable verbose output for details";
+        return;
+    }
+
+    // final output first, then LODs and other files in the order they were written
+    if (memory.get(output)) {
+        result->names.push_back(output);
+        result->files.push_back(memory.get(output));
+    }
+    for (const auto& name : memory.names()) {
+        if (name == source || name == output)
+            continue;
+        result->names.push_back(name);
+        result->files.push_back(memory.get(name));
+    }
+
+    result->success = true;
+}
+
+avatar_build_result* avatar_build_run(const uint8_t* input, size_t input_size, const char* pipeline_json,
+    const char* input_config_json, const char* output_config_json, const char* output_name)
+{
+    auto result = new avatar_build_result();
+    result->success = false;
+
+    // exceptions must not cross the C interface
+    try {
+        avatar_build_run_job(result, input, input_size, pipeline_json, input_config_json, output_config_json, output_name);
+    } catch (std::exception& e) {
+        result->success = false;
+        result->error = e.what();
+        result->names.clear();
+        result->files.clear();
+    }
+
+    return result;
+}
+
+int avatar_build_result_success(const avatar_build_result* result)
+{
+    return result != nullptr && result->success ? 1 : 0;
+}
+
+const char* avatar_build_result_error(const avatar_build_result* result)
+{
+    return result != nullptr ? result->error.c_str() : "";
+}
+
+size_t avatar_build_result_count(const avatar_build_result* result)
+{
+    return result != nullptr ? result->files.size() : 0;
+}
+
+const char* avatar_build_result_name(const avatar_build_result* result, size_t index)
+{
+    if (result == nullptr || index >= result->names.size())
+        return nullptr;
+    return result->names[index].c_str();
+}
+
+const uint8_t* avatar_build_result_data(const avatar_build_result* result, size_t index, size_t* size)
+{
+    if (result == nullptr || index >= result->files.size()) {
+        if (size != nullptr)
+            *size = 0;
+        return nullptr;
+    }
+
+    const auto& file = result->files[index];
+    if (size != nullptr)
+        *size = file->size();
+    return file->data();
+}
+
+void avatar_build_result_free(avatar_build_result* result)
+{
+    delete result;
+}
+
+void avatar_build_set_threads(size_t threads)
+{
+    gltf_set_threads_count(threads);
+}
+
+void avatar_build_set_simd(int enabled)
+{
+    pipeline_simd_enabled = enabled != 0;
+}
+
+void avatar_build_set_verbose(int enabled)
+{
+    pipeline_verbose_enabled = enabled != 0;
+}
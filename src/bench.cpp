@@ -0,0 +1,477 @@
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <regex>
+
+#include "avatar_build.hpp"
+#include "simd_check_func.inl"
+#include "synthetic_func.inl"
+
+// Benchmarks hot kernels and end-to-end pipelines against a model, prints JSON report.
+// Every iteration runs on a freshly loaded asset, only the kernel itself is timed.
+
+struct bench_result {
+    std::string suite;
+    std::string name;
+    std::vector<double> times_ms;
+    uint64_t vertices;
+    uint64_t bytes;
+    bool success;
+    std::string model;
+};
+
+// A loaded asset with everything components get from glb_load
+struct bench_asset {
+    cgltf_data* data = nullptr;
+    gltf_mesh_index index;
+    bone_mappings mappings;
+
+    bool load(const cmd_options* options, std::string input)
+    {
+        release();
+        if (gltf_parse_file(&options->gltf_options, input, nullptr, &data) != cgltf_result_success) {
+            data = nullptr;
+            return false;
+        }
+        if (cgltf_load_buffers(&options->gltf_options, data, input.c_str()) != cgltf_result_success) {
+            release();
+            return false;
+        }
+        gltf_build_mesh_index(data, &index);
+        mappings = bone_mappings();
+        gltf_parse_bone_mappings(data, &mappings, options);
+        return true;
+    }
+
+    void release()
+    {
+        if (data != nullptr) {
+            gltf_build_mesh_index(nullptr, &index);
+            gltf_free_data(data);
+            data = nullptr;
+        }
+    }
+
+    // base POSITION vertices, morph targets excluded
+    uint64_t vertices() const
+    {
+        uint64_t count = 0;
+        for (cgltf_size i = 0; i < index.accessor_roles.size(); ++i) {
+            if ((index.accessor_roles[i] & gltf_accessor_role_position) && index.accessor_target[i] == gltf_mesh_index_none)
+                count += data->accessors[i].count;
+        }
+        return count;
+    }
+
+    uint64_t buffer_bytes() const
+    {
+        uint64_t bytes = 0;
+        for (cgltf_size i = 0; i < data->buffers_count; ++i)
+            bytes += data->buffers[i].size;
+        return bytes;
+    }
+
+    ~bench_asset()
+    {
+        release();
+    }
+};
+
+static uint64_t bench_file_size(std::string path)
+{
+    std::error_code ec;
+    const auto size = fs::file_size(path, ec);
+    return ec ? 0 : (uint64_t)size;
+}
+
+// nearest rank percentile
+static double bench_percentile(std::vector<double> values, double percent)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const size_t rank = (size_t)std::ceil(percent / 100.0 * values.size());
+    return values[std::min(values.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+static json bench_report(const bench_result& result)
+{
+    const double median_ms = bench_percentile(result.times_ms, 50);
+    const double seconds = median_ms / 1000.0;
+    return {
+        { "model", result.model },
+        { "suite", result.suite },
+        { "name", result.name },
+        { "success", result.success },
+        { "iterations", result.times_ms.size() },
+        { "median_ms", median_ms },
+        { "p95_ms", bench_percentile(result.times_ms, 95) },
+        { "min_ms", result.times_ms.empty() ? 0 : *std::min_element(result.times_ms.begin(), result.times_ms.end()) },
+        { "vertices", result.vertices },
+        { "bytes", result.bytes },
+        { "vertices_per_s", seconds > 0 ? result.vertices / seconds : 0 },
+        { "mb_per_s", seconds > 0 ? result.bytes / (1024.0 * 1024.0) / seconds : 0 }
+    };
+}
+
+// setup is not timed, run is. Stops at the first failure.
+static bench_result bench_run(std::string suite, std::string name, size_t iterations, std::function<bool()> setup, std::function<bool()> run)
+{
+    bench_result result = { suite, name, {}, 0, 0, true, "" };
+    for (size_t i = 0; i < iterations && result.success; ++i) {
+        if (!setup()) {
+            result.success = false;
+            break;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        result.success = run();
+        result.times_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::cerr << "[BENCH] " << suite << "/" << name << (result.success ? "" : " FAILED") << std::endl;
+    return result;
+}
+
+static void bench_kernels(const cmd_options* options, std::string input, std::string work, size_t iterations, const std::regex& filter, std::vector<bench_result>* results)
+{
+    bench_asset asset;
+    if (!asset.load(options, input)) {
+        std::cout << "[ERROR] failed to load " << input << std::endl;
+        return;
+    }
+    const uint64_t vertices = asset.vertices();
+    const uint64_t bytes = asset.buffer_bytes();
+
+    const auto load = [&]() {
+        return asset.load(options, input);
+    };
+    const auto load_posed = [&]() {
+        // skinning has nothing to do until bones are moved, models without T pose are skinned as they are
+        if (!asset.load(options, input))
+            return false;
+        gltf_apply_pose("T", &asset.mappings, asset.index);
+        return true;
+    };
+    const auto load_dirty = [&]() {
+        // bounds of every accessor are stale, as after kernels writing all vertex data
+        if (!asset.load(options, input))
+            return false;
+        std::fill(asset.index.accessor_bounds_dirty.begin(), asset.index.accessor_bounds_dirty.end(), 1);
+        return true;
+    };
+
+    struct kernel {
+        std::string name;
+        std::function<bool()> setup;
+        std::function<bool()> run;
+    };
+    const std::string output = (fs::path(work) / "bench_write.glb").u8string();
+    const std::vector<kernel> kernels = {
+        { "gltf_skinning", load_posed, [&]() { return gltf_skinning(asset.data, asset.index); } },
+        { "gltf_apply_transform_meshes", load, [&]() { gltf_apply_transform_meshes(asset.data, asset.index); return true; } },
+        { "gltf_reverse_z", load, [&]() { gltf_reverse_z(asset.data, asset.index); return true; } },
+        { "gltf_upcast_joints", load, [&]() { return gltf_upcast_joints(asset.data, asset.index); } },
+        { "gltf_update_bounds", load_dirty, [&]() { gltf_update_bounds(asset.index); return true; } },
+        { "gltf_buffer_packing", load, [&]() { gltf_buffer_packing packing; gltf_buffer_packing_build(asset.data, &packing); return true; } },
+        { "gltf_images_jpg_to_png", load, [&]() { return gltf_images_jpg_to_png(asset.data); } },
+        { "gltf_write_file", load, [&]() { return gltf_write_file(&options->gltf_options, asset.data, output); } },
+        { "gltf_parse_bone_mappings", load, [&]() { bone_mappings mappings; return gltf_parse_bone_mappings(asset.data, &mappings, options); } },
+    };
+
+    for (const auto& k : kernels) {
+        if (!std::regex_search(k.name, filter))
+            continue;
+        auto result = bench_run("kernel", k.name, iterations, k.setup, k.run);
+        result.vertices = vertices;
+        result.bytes = bytes;
+        results->push_back(result);
+    }
+    asset.release();
+}
+
+// input kind a pipeline takes, guessed from its file name (fbx2glb.json, vrm02glb.json, glb_T_pose.json)
+static std::string bench_pipeline_input(std::string pipeline_name)
+{
+    if (pipeline_name.compare(0, 3, "fbx") == 0)
+        return ".fbx";
+    if (pipeline_name.compare(0, 4, "vrm0") == 0)
+        return ".vrm";
+    return ".glb";
+}
+
+static bool bench_run_pipeline(const cmd_options* base, std::string config, std::string input, std::string output)
+{
+    cmd_options options = *base;
+    options.config = config;
+    options.input = input;
+    options.output = output;
+    return start_pipelines(&options);
+}
+
+static void bench_pipelines(const cmd_options* options, std::string pipelines_dir, const std::unordered_map<std::string, std::string>& inputs, std::string work, size_t iterations, const std::regex& filter, std::vector<bench_result>* results)
+{
+    std::vector<fs::path> configs;
+    for (const auto& entry : fs::directory_iterator(pipelines_dir)) {
+        if (entry.path().extension() == ".json")
+            configs.push_back(entry.path());
+    }
+    std::sort(configs.begin(), configs.end());
+
+    for (const auto& config : configs) {
+        const auto name = config.stem().u8string();
+        if (!std::regex_search(name, filter))
+            continue;
+
+        const auto input = inputs.find(bench_pipeline_input(name));
+        if (input == inputs.end()) {
+            std::cerr << "[BENCH] pipeline/" << name << " skipped, no " << bench_pipeline_input(name) << " input" << std::endl;
+            continue;
+        }
+
+        const auto ext = name.find("2vrm0") != std::string::npos ? ".vrm" : ".glb";
+        const auto output = (fs::path(work) / (name + ext)).u8string();
+
+        auto result = bench_run("pipeline", name, iterations, []() { return true; }, [&]() {
+            return bench_run_pipeline(options, config.u8string(), input->second, output);
+        });
+
+        // vertices of fbx are counted on its converted glb
+        const auto gltf_input = input->first == ".fbx" ? inputs.find(".glb") : input;
+        bench_asset asset;
+        if (gltf_input != inputs.end() && asset.load(options, gltf_input->second))
+            result.vertices = asset.vertices();
+        result.bytes = bench_file_size(input->second);
+        results->push_back(result);
+    }
+}
+
+// Exponent of time against vertex count per benchmark (least squares on log-log) across models,
+// 1 is linear. Needs at least two models of different size.
+static json bench_scaling(const std::vector<bench_result>& results)
+{
+    std::map<std::string, std::vector<const bench_result*>> groups;
+    for (const auto& result : results) {
+        if (result.success && result.vertices > 0 && !result.times_ms.empty())
+            groups[result.suite + "/" + result.name].push_back(&result);
+    }
+
+    json scaling = json::array();
+    for (const auto& group : groups) {
+        if (group.second.size() < 2)
+            continue;
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        const double n = (double)group.second.size();
+        for (const auto result : group.second) {
+            const double x = std::log((double)result->vertices);
+            const double y = std::log(std::max(bench_percentile(result->times_ms, 50), 1e-6));
+            sx += x, sy += y, sxx += x * x, sxy += x * y;
+        }
+        const double denominator = n * sxx - sx * sx;
+        if (denominator <= 0)
+            continue;
+        const double exponent = (n * sxy - sx * sy) / denominator;
+        if (exponent > 1.2)
+            std::cerr << "[BENCH] " << group.first << " scales super-linearly: O(n^" << exponent << ")" << std::endl;
+        scaling.push_back({ { "name", group.first }, { "exponent", exponent } });
+    }
+    return scaling;
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app { "avatar-bench: Benchmark avatar asset pipeline kernels and pipelines" };
+
+    std::string input = "models/Female_Adult_01.fbx";
+    app.add_option("-i,--input", input, "Model to benchmark (.fbx, .glb or .vrm)")->check(CLI::ExistingFile);
+
+    std::string input_config = "models/input.rocketbox.json";
+    app.add_option("-m,--input_config", input_config, "Input configuration file name (JSON)");
+
+    std::string output_config = "models/output.rocketbox.json";
+    app.add_option("-n,--output_config", output_config, "Output configuration file name (JSON)");
+
+    std::string pipelines_dir = "pipelines";
+    app.add_option("-p,--pipelines", pipelines_dir, "Directory of pipelines to run end-to-end")->check(CLI::ExistingDirectory);
+
+    std::string fbx2gltf = "extern/fbx2gltf.exe";
+    app.add_option("-x,--fbx2gltf", fbx2gltf, "Path to fbx2gltf executable");
+
+    std::string work = "bench_work";
+    app.add_option("-w,--work", work, "Directory for intermediate and output files");
+
+    std::string output;
+    app.add_option("-o,--output", output, "Write JSON report to the file instead of stdout");
+
+    size_t iterations = 10;
+    app.add_option("-r,--iterations", iterations, "Iterations per benchmark");
+
+    std::string filter = ".*";
+    app.add_option("-f,--filter", filter, "Run benchmarks whose name matches the regular expression");
+
+    size_t threads = 0;
+    app.add_option("-t,--threads", threads, "Number of threads for geometry processing (0: all hardware threads)");
+
+    bool simd = false;
+    app.add_flag("--simd", simd, "Enable SIMD kernels, results may differ from the scalar reference implementation by rounding");
+
+    bool check = false;
+    app.add_flag("--check", check, "Compare every SIMD kernel the CPU supports against the scalar reference implementation and exit");
+
+    // synthetic avatars, bone names are taken from --input_config
+    std::vector<size_t> synthetic;
+    app.add_option("--synthetic", synthetic, "Benchmark synthetic avatars of these vertex counts instead of --input (e.g. 10000,100000,1000000)")->delimiter(',');
+
+    std::string generate;
+    app.add_option("--generate", generate, "Write a synthetic avatar (.glb or .vrm) with --vertices and exit");
+
+    synthetic_avatar_params params;
+    app.add_option("--vertices", params.vertices, "Synthetic avatar: vertex count for --generate");
+    app.add_option("--primitives", params.primitives, "Synthetic avatar: number of primitives");
+    app.add_option("--bone_depth", params.bone_depth, "Synthetic avatar: extra joints chained under Head");
+    app.add_option("--morph_targets", params.morph_targets, "Synthetic avatar: morph targets per primitive");
+    app.add_option("--textures", params.textures, "Synthetic avatar: number of textures");
+    app.add_option("--texture_size", params.texture_size, "Synthetic avatar: texture width and height");
+    app.add_option("--animation_length", params.animation_length, "Synthetic avatar: animation length in seconds (0: no animation)");
+    bool png = false;
+    app.add_flag("--png", png, "Synthetic avatar: png textures instead of jpeg");
+
+    CLI11_PARSE(app, argc, argv);
+
+    params.texture_jpeg = !png;
+
+    pipeline_simd_enabled = simd;
+    gltf_set_threads_count(threads);
+
+    if (check)
+        return simd_check_kernels() ? 0 : 1;
+
+    cgltf_options gltf_options = {};
+#ifdef WIN32
+    gltf_options.file.read = &gltf_file_read;
+#else
+    gltf_options.file.read = &gltf_file_read;
+    gltf_options.file.release = &gltf_file_release;
+#endif
+
+    cmd_options options = { "", input, "", input_config, output_config, fbx2gltf, false, false, gltf_options };
+    if (!input_config.empty() && !json_parse(input_config, &options.input_config_json)) {
+        std::cout << "[ERROR] Unable to load " << input_config << std::endl;
+        return 1;
+    }
+    if (!output_config.empty() && !json_parse(output_config, &options.output_config_json)) {
+        std::cout << "[ERROR] Unable to load " << output_config << std::endl;
+        return 1;
+    }
+
+    fs::create_directories(work);
+
+    if (!generate.empty()) {
+        params.vrm = gltf_str_tolower(fs::path(generate).extension().u8string()) == ".vrm";
+        if (!synthetic_avatar_write(params, options.input_config_json, generate)) {
+            std::cout << "[ERROR] failed to write " << generate << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // every kind of input the pipelines take, by model
+    std::vector<std::pair<std::string, std::unordered_map<std::string, std::string>>> models;
+    if (synthetic.empty()) {
+        std::unordered_map<std::string, std::string> inputs;
+        const auto model_ext = gltf_str_tolower(fs::path(input).extension().u8string());
+        const auto model_stem = (fs::path(work) / fs::path(input).stem()).u8string();
+        inputs[model_ext == ".vrm" ? ".vrm" : model_ext == ".fbx" ? ".fbx" : ".glb"] = input;
+
+        // converted from the given model once
+        if (!inputs.count(".glb") && inputs.count(".fbx")) {
+            const auto glb = model_stem + ".glb";
+            if (bench_run_pipeline(&options, (fs::path(pipelines_dir) / "fbx2glb.json").u8string(), input, glb))
+                inputs[".glb"] = glb;
+        }
+        if (!inputs.count(".vrm") && inputs.count(".glb")) {
+            const auto vrm = model_stem + ".vrm";
+            if (bench_run_pipeline(&options, (fs::path(pipelines_dir) / "glb2vrm0.json").u8string(), inputs[".glb"], vrm))
+                inputs[".vrm"] = vrm;
+        }
+        models.push_back({ input, inputs });
+    } else {
+        for (const auto vertices : synthetic) {
+            const auto stem = (fs::path(work) / ("synthetic_" + std::to_string(vertices))).u8string();
+            auto model_params = params;
+            model_params.vertices = vertices;
+            std::unordered_map<std::string, std::string> inputs;
+            for (const auto ext : { ".glb", ".vrm" }) {
+                model_params.vrm = std::string(ext) == ".vrm";
+                if (synthetic_avatar_write(model_params, options.input_config_json, stem + ext))
+                    inputs[ext] = stem + ext;
+            }
+            models.push_back({ "synthetic_" + std::to_string(vertices), inputs });
+        }
+    }
+
+    const std::regex filter_re(filter);
+    std::vector<bench_result> results;
+
+    for (const auto& model : models) {
+        const auto& inputs = model.second;
+        const size_t first = results.size();
+
+        const std::string kernel_input = inputs.count(".glb") ? inputs.at(".glb") : inputs.count(".vrm") ? inputs.at(".vrm") : "";
+        if (!kernel_input.empty()) {
+            bench_kernels(&options, kernel_input, work, iterations, filter_re, &results);
+        } else {
+            std::cout << "[ERROR] no glTF input for kernels, check --fbx2gltf" << std::endl;
+        }
+        bench_pipelines(&options, pipelines_dir, inputs, work, iterations, filter_re, &results);
+
+        for (size_t i = first; i < results.size(); ++i)
+            results[i].model = model.first;
+    }
+
+    json report_results = json::array();
+    bool success = true;
+    for (const auto& result : results) {
+        report_results.push_back(bench_report(result));
+        success = success && result.success;
+    }
+    const json report = {
+        { "input", input },
+        { "iterations", iterations },
+        { "threads", threads },
+        { "simd", simd },
+        { "results", report_results },
+        { "scaling", bench_scaling(results) }
+    };
+
+    if (output.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream fout(output, std::ios::out | std::ios::trunc);
+        fout << report.dump(2) << std::endl;
+    }
+
+    return success ? 0 : 1;
+}
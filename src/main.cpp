@@ -1,271 +1,317 @@
-/* avatar-build is distributed under MIT license:
- *
- * Copyright (c) 2021 Kota Iguchi
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
- * SOFTWARE.
- */
-#include <fstream>
-#include <iostream>
-#include <string>
-#include <vector>
-
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#define STB_LEAKCHECK_IMPLEMENTATION
-#include "stb_image.h"
-#include "stb_image_write.h"
-#include "stb_leakcheck.h"
-
-#include "CLI11.hpp"
-#include "DSPatch.h"
-#include "json.hpp"
-
-#define CGLTF_IMPLEMENTATION
-#define CGLTF_WRITE_IMPLEMENTATION
-#define CGLTF_VRM_v0_0
-#define CGLTF_VRM_v0_0_IMPLEMENTATION
-#include "cgltf_write.h"
-
-#pragma warning(push)
-#pragma warning(disable : 4458) // declaration of 'source' hides class member
-#include "verbalexpressions.hpp"
-#pragma warning(pop)
-
-#include <ghc/filesystem.hpp>
-
-namespace fs = ghc::filesystem;
-using json = nlohmann::json;
-
-#include "pipelines.hpp"
-#include "gltf_func.inl"
-#include "gltf_overrides_func.inl"
-#include "json_func.inl"
-#include "bones_func.inl"
-#include "vrm0_func.inl"
-
-#include "glb_T_pose.hpp"
-#include "glb_jpeg_to_png.hpp"
-#include "glb_fix_roll.hpp"
-#include "glb_transforms_apply.hpp"
-#include "glb_z_reverse.hpp"
-#include "glb_overrides.hpp"
-#include "vrm0_fix_joint_buffer.hpp"
-#include "vrm0_default_extensions.hpp"
-#include "vrm0_remove_extensions.hpp"
-#include "gltf_pipeline.hpp"
-#include "gltfpack_execute.hpp"
-#include "gltfpack_pipeline.hpp"
-#include "noop.hpp"
-
-#include "fbx2gltf_execute.hpp"
-#include "fbx_pipeline.hpp"
-
-using namespace AvatarBuild;
-
-using json = nlohmann::json;
-
-static std::shared_ptr<DSPatch::Component> create_component(std::string name, cmd_options* options)
-{
-    if (name == "glb_z_reverse") {
-        return std::make_shared<DSPatch::glb_z_reverse>(options);
-    } else if (name == "glb_transforms_apply") {
-        return std::make_shared<DSPatch::glb_transforms_apply>(options);
-    } else if (name == "glb_jpeg_to_png") {
-        return std::make_shared<DSPatch::glb_jpeg_to_png>(options);
-    } else if (name == "glb_fix_roll") {
-        return std::make_shared<DSPatch::glb_fix_roll>(options);
-    } else if (name == "glb_T_pose") {
-        return std::make_shared<DSPatch::glb_T_pose>(options);
-    } else if (name == "glb_overrides") {
-        return std::make_shared<DSPatch::glb_overrides>(options);
-    } else if (name == "vrm0_fix_joint_buffer") {
-        return std::make_shared<DSPatch::vrm0_fix_joint_buffer>(options);
-    } else if (name == "vrm0_default_extensions") {
-        return std::make_shared<DSPatch::vrm0_default_extensions>(options);
-    } else if (name == "vrm0_remove_extensions") {
-        return std::make_shared<DSPatch::vrm0_remove_extensions>(options);
-    } else if (name == "fbx2gltf_execute") {
-        return std::make_shared<DSPatch::fbx2gltf_execute>(options);
-    } else if (name == "gltfpack_execute") {
-        return std::make_shared<DSPatch::gltfpack_execute>(options);
-    }
-    return std::make_shared<DSPatch::noop>(options, name);
-}
-
-static std::shared_ptr<pipeline_processor> create_pipeline(std::string name, cmd_options* options)
-{
-    if (name == "gltf_pipeline") {
-        return std::make_shared<AvatarBuild::gltf_pipeline>(name, options);
-    } else if (name == "fbx_pipeline") {
-        return std::make_shared<AvatarBuild::fbx_pipeline>(name, options);
-    } else if (name == "gltfpack_pipeline") {
-        return std::make_shared<AvatarBuild::gltfpack_pipeline>(name, options);
-    }
-    return std::make_shared<AvatarBuild::pipeline_processor>(name, options);
-}
-
-static std::shared_ptr<pipeline_processor> wire_pipeline(pipeline* p, cmd_options* options)
-{
-    const auto pipeline = create_pipeline(p->name, options);
-
-    for (size_t i = 0; i < p->components.size(); ++i) {
-        pipeline->add_component(create_component(p->components[i], options));
-    }
-
-    pipeline->wire_components();
-
-    return pipeline;
-}
-
-static bool build_and_start_circuits(cmd_options* options, json config_json)
-{
-    try {
-        const auto& pipelines_obj = config_json["pipelines"];
-        if (!pipelines_obj.is_array()) {
-            std::cout << "[ERROR] pipeline '" << config_json["name"] << "' is not an array" << std::endl;
-            return false;
-        }
-
-        auto circuit = std::make_shared<DSPatch::Circuit>();
-
-        std::vector<std::shared_ptr<pipeline_processor>> pipelines;
-        for (const auto& obj : pipelines_obj) {
-            pipeline p;
-            p.name = obj["name"];
-            p.components = json_get_string_items("components", obj);
-
-            auto component = wire_pipeline(&p, options);
-            circuit->AddComponent(component);
-
-            if (!pipelines.empty()) {
-                circuit->ConnectOutToIn(pipelines.back(), 0, component, 0);
-            }
-
-            pipelines.push_back(component);
-        }
-
-        // make sure to execute pipeline in TickMode::Series
-        // because pipeline has state and not thread safe.
-        circuit->Tick(DSPatch::Component::TickMode::Series);
-
-        // Check if pipeline has failure
-        for (const auto pipeline : pipelines) {
-            if (pipeline->is_discarded())
-                return false;
-        }
-
-        return true;
-    } catch (json::exception& e) {
-        std::cout << "[ERROR] error while parsing pipeline '" << config_json["name"] << "'" << std::endl;
-        std::cout << "\t " << e.what() << std::endl;
-        return false;
-    }
-}
-
-static bool start_pipelines(cmd_options* options)
-{
-    json config_json;
-
-    if (!json_parse(options->config, &config_json)) {
-        return false;
-    }
-
-    if (options->verbose) {
-        std::cout << "[INFO] Starting pipeline '" << config_json["name"] << "'" << std::endl;
-        std::cout << "[INFO] " << config_json["description"] << std::endl;
-    }
-
-    return build_and_start_circuits(options, config_json);
-}
-
-int main(int argc, char** argv)
-{
-    CLI::App app { "avatar-build: Run avatar asset pipeline" };
-
-    std::string config = "pipelines/config.json";
-    app.add_option("-p,--pipeline", config, "Pipeline configuration file name (JSON)")->required();
-
-    bool verbose = false;
-    app.add_flag("-v,--verbose", verbose, "Verbose log output");
-
-    bool debug = false;
-    app.add_flag("-d,--debug", debug, "Enable debug output");
-
-    std::string input;
-    app.add_option("-i,--input", input, "Input file name")->check(CLI::ExistingFile)->required();
-
-    std::string output;
-    app.add_option("-o,--output", output, "Output file name")->required();
-
-    std::string input_config;
-    app.add_option("-m,--input_config", input_config, "Input configuration file name (JSON)");
-
-    std::string output_config;
-    app.add_option("-n,--output_config", output_config, "Output configuration file name (JSON)");
-
-    std::string fbx2gltf = "extern/fbx2gltf.exe";
-    app.add_option("-x,--fbx2gltf", fbx2gltf, "Path to fbx2gltf executable")->check(CLI::ExistingFile);
-
-    CLI11_PARSE(app, argc, argv);
-
-    // common mistake
-    if (input == output) {
-        AVATAR_PIPELINE_LOG("[ERROR] Input and Output file should not be same: " << input);
-        return 1;
-    }
-
-    cgltf_options gltf_options = { };
-
-#ifdef WIN32
-    // enable multibyte file name
-    gltf_options.file.read = &gltf_file_read;
-#endif
-
-    // setup memory allocation check
-    if (debug) {
-        gltf_options.memory.alloc = &gltf_leakcheck_malloc;
-        gltf_options.memory.free = &gltf_leackcheck_free;
-
-        pipeline_leackcheck_enabled = true;
-    }
-
-    pipeline_verbose_enabled = verbose;
-
-    cmd_options options = { config, input, output, input_config, output_config, fbx2gltf, verbose, debug, gltf_options };
-
-    if (!options.input_config.empty() && !json_parse(options.input_config, &options.input_config_json)) {
-        AVATAR_PIPELINE_LOG("[ERROR] Unable to load " << options.input_config);
-        return 1;
-    }
-    if (!options.output_config.empty() && !json_parse(options.output_config, &options.output_config_json)) {
-        AVATAR_PIPELINE_LOG("[ERROR] Unable to load " << options.output_config);
-        return 1;
-    }
-
-    int status = 0;
-    if (!start_pipelines(&options)) {
-        status = 1;
-    }
-
-    if (debug && stb_leakcheck_dumpmem()) {
-        status = 1;
-    }
-
-    return status;
+/* avatar-build is distributed under MIT license:
+ *
+ * Copyright (c) 2021 Kota Iguchi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avatar_build.hpp"
+#include "serve_func.inl"
+
+struct batch_job {
+    std::string input;
+    std::string output;
+    bool success;
+    double elapsed_ms;
+};
+
+static bool parse_batch_manifest(std::string manifest, std::vector<batch_job>* jobs)
+{
+    json manifest_json;
+    if (!json_parse(manifest, &manifest_json)) {
+        return false;
+    }
+
+    // paths are relative to manifest file
+    const fs::path base = fs::path(manifest).parent_path();
+
+    const auto& jobs_obj = manifest_json["jobs"];
+    if (!jobs_obj.is_array()) {
+        std::cout << "[ERROR] 'jobs' is not an array in " << manifest << std::endl;
+        return false;
+    }
+
+    for (const auto& obj : jobs_obj) {
+        if (!obj["input"].is_string() || !obj["output"].is_string()) {
+            std::cout << "[ERROR] job requires 'input' and 'output' in " << manifest << std::endl;
+            return false;
+        }
+        batch_job job = {};
+        job.input = (base / fs::path(obj["input"].get<std::string>())).u8string();
+        job.output = (base / fs::path(obj["output"].get<std::string>())).u8string();
+        jobs->push_back(job);
+    }
+
+    return true;
+}
+
+// Runs all jobs of the manifest through the same pipeline definition. Pipeline and input/output
+// configs are parsed once and shared read-only, each job gets its own job_context.
+static bool start_batch(const cmd_options* options, std::string manifest, size_t workers_count)
+{
+    json config_json;
+    if (!json_parse(options->config, &config_json)) {
+        return false;
+    }
+
+    std::vector<batch_job> jobs;
+    if (!parse_batch_manifest(manifest, &jobs)) {
+        return false;
+    }
+
+    if (workers_count == 0) {
+        workers_count = std::thread::hardware_concurrency();
+    }
+    if (workers_count == 0) {
+        workers_count = 1;
+    }
+    workers_count = std::min(workers_count, jobs.size());
+
+    if (options->verbose) {
+        std::cout << "[INFO] Starting batch '" << manifest << "' (" << jobs.size() << " jobs, " << workers_count << " workers)" << std::endl;
+    }
+
+    std::atomic<size_t> next_job { 0 };
+    auto worker = [&]() {
+        for (;;) {
+            const size_t i = next_job.fetch_add(1);
+            if (i >= jobs.size())
+                break;
+
+            auto& job = jobs[i];
+
+            job_context context = { options, job.input, job.output };
+
+            const auto start = std::chrono::steady_clock::now();
+            if (job.input == job.output) {
+                AVATAR_PIPELINE_LOG("[ERROR] Input and Output file should not be same: " << job.input);
+                job.success = false;
+            } else if (!fs::exists(job.input)) {
+                AVATAR_PIPELINE_LOG("[ERROR] Input file not found: " << job.input);
+                job.success = false;
+            } else {
+                job.success = build_and_start_circuits(&context, config_json);
+            }
+            job.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < workers_count; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    // summary is written next to manifest: <manifest>.summary.json
+    size_t failed = 0;
+    json summary_jobs = json::array();
+    for (const auto& job : jobs) {
+        if (!job.success)
+            ++failed;
+        summary_jobs.push_back({ { "input", job.input }, { "output", job.output }, { "success", job.success }, { "elapsed_ms", job.elapsed_ms } });
+    }
+    json summary = { { "pipeline", options->config }, { "jobs", summary_jobs }, { "succeeded", jobs.size() - failed }, { "failed", failed } };
+
+    const auto summary_file = path_without_extension(manifest).u8string() + ".summary.json";
+    std::ofstream summary_out(summary_file, std::ios::out);
+    summary_out << summary.dump(2) << std::endl;
+
+    std::cout << "[INFO] batch finished: " << (jobs.size() - failed) << " succeeded, " << failed << " failed. Summary: " << summary_file << std::endl;
+
+    return failed == 0;
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app { "avatar-build: Run avatar asset pipeline" };
+
+    std::string config = "pipelines/config.json";
+    app.add_option("-p,--pipeline", config, "Pipeline configuration file name (JSON)")->required();
+
+    bool verbose = false;
+    app.add_flag("-v,--verbose", verbose, "Verbose log output");
+
+    bool debug = false;
+    app.add_flag("-d,--debug", debug, "Enable debug output");
+
+    std::string input;
+    app.add_option("-i,--input", input, "Input file name")->check(CLI::ExistingFile);
+
+    std::string output;
+    app.add_option("-o,--output", output, "Output file name");
+
+    std::string input_config;
+    app.add_option("-m,--input_config", input_config, "Input configuration file name (JSON)");
+
+    std::string output_config;
+    app.add_option("-n,--output_config", output_config, "Output configuration file name (JSON)");
+
+    std::string fbx2gltf = "extern/fbx2gltf.exe";
+    app.add_option("-x,--fbx2gltf", fbx2gltf, "Path to fbx2gltf executable")->check(CLI::ExistingFile);
+
+    bool simd = false;
+    app.add_flag("--simd", simd, "Enable SIMD kernels, results may differ from the scalar reference implementation by rounding");
+
+    size_t threads = 0;
+    app.add_option("-t,--threads", threads, "Number of threads for geometry processing (0: all hardware threads)");
+
+    std::string batch;
+    app.add_option("-b,--batch", batch, "Batch manifest file name (JSON), runs all jobs instead of --input/--output")->check(CLI::ExistingFile);
+
+    size_t jobs = 1;
+    app.add_option("-j,--jobs", jobs, "Number of batch or server jobs running at the same time (0: all hardware threads)");
+
+    std::string serve;
+    app.add_option("--serve", serve, "Run as build server on the Unix domain socket path ('-': JSON lines on stdin/stdout)");
+
+    std::string trace_file;
+    app.add_option("--trace", trace_file, "Write timing trace to the file (Chrome trace event format JSON)");
+
+    bool memory_profile = false;
+    app.add_flag("--memory_profile", memory_profile, "Print allocation count, bytes and peak live bytes per pipeline and component");
+
+    std::string memory_report;
+    app.add_option("--memory_report", memory_report, "Write allocation profile to the file (JSON)");
+
+    std::string cache_dir;
+    app.add_option("--cache", cache_dir, "Build cache directory, skips pipelines whose result is cached");
+
+    size_t cache_size = 2048;
+    app.add_option("--cache_size", cache_size, "Maximum size of build cache in MB");
+
+    CLI11_PARSE(app, argc, argv);
+
+    const bool single_job = batch.empty() && serve.empty();
+    if (single_job && (input.empty() || output.empty())) {
+        std::cout << "[ERROR] --input and --output are required unless --batch or --serve is specified" << std::endl;
+        return 1;
+    }
+
+    // common mistake
+    if (single_job && input == output) {
+        AVATAR_PIPELINE_LOG("[ERROR] Input and Output file should not be same: " << input);
+        return 1;
+    }
+
+    cgltf_options gltf_options = { };
+
+#ifdef WIN32
+    // enable multibyte file name
+    gltf_options.file.read = &gltf_file_read;
+#else
+    // map input files instead of reading them
+    gltf_options.file.read = &gltf_file_read;
+    gltf_options.file.release = &gltf_file_release;
+#endif
+
+    // setup memory allocation check, profiler has to be enabled before the first allocation
+    alloc_profiler profiler;
+    if (memory_profile || !memory_report.empty()) {
+        pipeline_alloc_profiler = &profiler;
+    }
+    if (debug) {
+        pipeline_leackcheck_enabled = true;
+    }
+    if (pipeline_leackcheck_enabled || pipeline_alloc_profiler) {
+        gltf_options.memory.alloc = &gltf_memory_alloc;
+        gltf_options.memory.free = &gltf_memory_free;
+    }
+
+    pipeline_verbose_enabled = verbose;
+    pipeline_simd_enabled = simd;
+    gltf_set_threads_count(threads);
+
+    cmd_options options = { config, input, output, input_config, output_config, fbx2gltf, verbose, debug, gltf_options };
+
+    if (!options.input_config.empty() && !json_parse(options.input_config, &options.input_config_json)) {
+        AVATAR_PIPELINE_LOG("[ERROR] Unable to load " << options.input_config);
+        return 1;
+    }
+    if (!options.output_config.empty() && !json_parse(options.output_config, &options.output_config_json)) {
+        AVATAR_PIPELINE_LOG("[ERROR] Unable to load " << options.output_config);
+        return 1;
+    }
+
+    std::unique_ptr<build_cache> cache;
+    if (!cache_dir.empty()) {
+        cache.reset(new build_cache(cache_dir, (uint64_t)cache_size * 1024 * 1024));
+        options.cache = cache.get();
+    }
+
+    std::unique_ptr<trace_recorder> trace;
+    if (!trace_file.empty()) {
+        trace.reset(new trace_recorder(trace_file));
+        if (!trace->is_open()) {
+            std::cout << "[ERROR] failed to write trace " << trace_file << std::endl;
+            return 1;
+        }
+        pipeline_trace = trace.get();
+    }
+
+    int status = 0;
+    if (!serve.empty()) {
+        if (!start_server(&options, serve, jobs)) {
+            status = 1;
+        }
+    } else if (!batch.empty()) {
+        if (!start_batch(&options, batch, jobs)) {
+            status = 1;
+        }
+    } else if (!start_pipelines(&options)) {
+        status = 1;
+    }
+
+    if (trace) {
+        if (trace->close()) {
+            AVATAR_PIPELINE_LOG("[INFO] trace written to " << trace_file);
+        } else {
+            std::cout << "[ERROR] failed to write trace " << trace_file << std::endl;
+            status = 1;
+        }
+        pipeline_trace = nullptr;
+    }
+
+    if (memory_profile) {
+        profiler.print();
+    }
+    if (!memory_report.empty()) {
+        std::ofstream report_out(memory_report, std::ios::out | std::ios::trunc);
+        report_out << profiler.report().dump(2) << std::endl;
+        if (report_out.fail()) {
+            std::cout << "[ERROR] failed to write memory report " << memory_report << std::endl;
+            status = 1;
+        }
+    }
+
+    if (debug && pipeline_leak_checker.dump()) {
+        status = 1;
+    }
+
+    return status;
 }
\ No newline at end of file